@@ -0,0 +1,142 @@
+// Вытеснение page cache при compact(): buffered vs direct I/O.
+//
+//   bench_compact_get [dir] [cold_mb] [hot_mb] [value_bytes]
+//
+// Две независимые базы: «холодная» (cold_mb данных, половина перезаписана —
+// мёртвые байты для compaction) открывается в проверяемом режиме, «горячая»
+// (hot_mb) — всегда buffered и прогрета в page cache. compact() холодной базы
+// не держит mu_ горячей, поэтому латентность GET горячей базы меряет только
+// вытеснение её страниц из кэша: до compaction, во время и сразу после.
+// Эффект виден, когда cold_mb заметно больше свободной памяти (или процесс
+// запущен в cgroup с лимитом памяти — page cache учитывается в лимите).
+#include "kv/kvstore.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Phase {
+    size_t gets = 0;
+    double p50_us = 0, p99_us = 0, p999_us = 0, max_us = 0;
+};
+
+struct Result {
+    Phase before, during, after;
+    double compact_ms = 0;
+};
+
+std::string key_of(uint64_t i) { return "key:" + std::to_string(i); }
+
+double pct(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    auto idx = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+    return sorted[idx];
+}
+
+Phase summarize(std::vector<double>& lat) {
+    std::sort(lat.begin(), lat.end());
+    Phase r;
+    r.gets = lat.size();
+    r.p50_us = pct(lat, 0.50);
+    r.p99_us = pct(lat, 0.99);
+    r.p999_us = pct(lat, 0.999);
+    r.max_us = lat.empty() ? 0 : lat.back();
+    return r;
+}
+
+Config make_config(const std::filesystem::path& dir, bool direct) {
+    Config cfg;
+    cfg.data_dir = dir;
+    cfg.segment_max_bytes = 64ull * 1024 * 1024;
+    cfg.fsync_each_write = false;
+    cfg.direct_io = direct;
+    return cfg;
+}
+
+Result run(const std::filesystem::path& dir, bool direct, uint64_t cold_mb,
+           uint64_t hot_mb, size_t value_bytes)
+{
+    std::filesystem::remove_all(dir);
+    const std::string value(value_bytes, 'v');
+    const uint64_t cold_keys = std::max<uint64_t>(1, (cold_mb << 20) / value_bytes);
+    const uint64_t hot_keys  = std::max<uint64_t>(1, (hot_mb << 20) / value_bytes);
+
+    KVStore cold(make_config(dir / "cold", direct));
+    for (uint64_t i = 0; i < cold_keys; ++i) cold.set(key_of(i), value);
+    for (uint64_t i = 0; i < cold_keys; i += 2) cold.set(key_of(i), value);
+
+    // горячую базу пишем и прогреваем последней — её страницы свежие в кэше
+    KVStore hot(make_config(dir / "hot", false));
+    for (uint64_t i = 0; i < hot_keys; ++i) hot.set(key_of(i), value);
+    for (int pass = 0; pass < 2; ++pass)
+        for (uint64_t i = 0; i < hot_keys; ++i) (void)hot.get(key_of(i));
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> pick(0, hot_keys - 1);
+    auto timed_get = [&](std::vector<double>& lat) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto v = hot.get(key_of(pick(rng)));
+        auto t1 = std::chrono::steady_clock::now();
+        if (!v) std::fprintf(stderr, "missing key\n");
+        lat.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    };
+    const size_t probe = static_cast<size_t>(std::min<uint64_t>(hot_keys, 20000));
+
+    Result r;
+    std::vector<double> lat;
+    for (size_t i = 0; i < probe; ++i) timed_get(lat);
+    r.before = summarize(lat);
+
+    std::atomic<bool> done{false};
+    std::thread compactor([&]{
+        auto t0 = std::chrono::steady_clock::now();
+        if (auto ec = cold.compact(); ec) std::fprintf(stderr, "compact: %s\n", ec.message().c_str());
+        r.compact_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        done.store(true);
+    });
+    lat.clear();
+    while (!done.load()) timed_get(lat);
+    compactor.join();
+    r.during = summarize(lat);
+
+    lat.clear();
+    for (size_t i = 0; i < probe; ++i) timed_get(lat);
+    r.after = summarize(lat);
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::filesystem::path base = argc > 1 ? argv[1] : "./bench_data";
+    const uint64_t cold_mb   = argc > 2 ? std::stoull(argv[2]) : 4096;
+    const uint64_t hot_mb    = argc > 3 ? std::stoull(argv[3]) : 128;
+    const size_t value_bytes = argc > 4 ? std::stoul(argv[4]) : 4096;
+
+    std::printf("cold=%lluMiB hot=%lluMiB value=%zuB\n",
+                static_cast<unsigned long long>(cold_mb),
+                static_cast<unsigned long long>(hot_mb), value_bytes);
+    std::printf("%-9s %-7s %10s %10s %10s %10s %10s\n",
+                "mode", "phase", "gets", "p50_us", "p99_us", "p999_us", "max_us");
+    for (bool direct : {false, true}) {
+        const char* mode = direct ? "direct" : "buffered";
+        auto r = run(base / mode, direct, cold_mb, hot_mb, value_bytes);
+        auto row = [&](const char* phase, const Phase& p) {
+            std::printf("%-9s %-7s %10zu %10.1f %10.1f %10.1f %10.1f\n",
+                        mode, phase, p.gets, p.p50_us, p.p99_us, p.p999_us, p.max_us);
+        };
+        row("before", r.before);
+        row("during", r.during);
+        row("after", r.after);
+        std::printf("%-9s compact_ms=%.1f\n", mode, r.compact_ms);
+        std::filesystem::remove_all(base / mode);
+    }
+    std::filesystem::remove_all(base);
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Стоимость метрик на горячем пути SET/GET.
+//
+//   bench_metrics_overhead [dir] [keys] [value_bytes] [trials]
+//
+// Исходник собирается дважды: bench_metrics_overhead (с метриками) и
+// bench_metrics_overhead_bare (MINI_DB_METRICS=0, инструментирование вырезано
+// при компиляции). Запущенный без --trial бинарник — драйвер: по очереди
+// запускает оба в режиме --trial (каждый на свежей базе, порядок
+// чередуется). Шум машины (соседи по хосту, частота CPU) только замедляет
+// пачки, поэтому запуск отдаёт свою лучшую пачку, а overhead считается по
+// медианам этих значений.
+#include "kv/kvstore.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int kPasses = 100; // пачек SET/GET в одном --trial
+
+std::string key_of(uint64_t i) { return "key:" + std::to_string(i); }
+
+template <class F>
+double ns_per_op(size_t n, F&& body) {
+    auto t0 = std::chrono::steady_clock::now();
+    body();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / static_cast<double>(n);
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0 : v[v.size() / 2];
+}
+
+double min_of(const std::vector<double>& v) {
+    return v.empty() ? 0 : *std::min_element(v.begin(), v.end());
+}
+
+// Один замер в этом процессе: лучшие из kPasses ns/op SET и GET пишутся в out.
+int trial(const std::filesystem::path& dir, uint64_t nkeys, size_t value_bytes,
+          const std::filesystem::path& out)
+{
+    std::filesystem::remove_all(dir);
+    Config cfg;
+    cfg.data_dir = dir;
+    cfg.segment_max_bytes = 256ull * 1024 * 1024;
+    cfg.fsync_each_write = false;
+
+    std::vector<std::string> keys;
+    keys.reserve(nkeys);
+    for (uint64_t i = 0; i < nkeys; ++i) keys.push_back(key_of(i));
+    const std::string value(value_bytes, 'v');
+
+    std::vector<double> set_ns, get_ns;
+    size_t found = 0;
+    {
+        KVStore db(cfg);
+        for (auto& k : keys) db.set(k, value);  // прогрев
+        for (auto& k : keys) found += db.get(k).has_value();
+        for (int p = 0; p < kPasses; ++p) {
+            set_ns.push_back(ns_per_op(keys.size(), [&]{
+                for (auto& k : keys) db.set(k, value);
+            }));
+            get_ns.push_back(ns_per_op(keys.size(), [&]{
+                for (auto& k : keys) found += db.get(k).has_value();
+            }));
+        }
+    }
+    std::filesystem::remove_all(dir);
+    if (found != keys.size() * (kPasses + 1)) {
+        std::fprintf(stderr, "missing keys\n");
+        return 1;
+    }
+    std::ofstream f(out, std::ios::trunc);
+    f << min_of(set_ns) << ' ' << min_of(get_ns) << '\n';
+    return f ? 0 : 1;
+}
+
+bool run_trial(const std::filesystem::path& exe, const std::filesystem::path& dir,
+               uint64_t nkeys, size_t value_bytes, double& set_ns, double& get_ns)
+{
+    const std::filesystem::path out = dir.string() + ".result";
+    auto quoted = [](const std::filesystem::path& p) { return '"' + p.string() + '"'; };
+    std::string cmd = quoted(exe);
+    cmd += " --trial ";
+    cmd += quoted(dir);
+    cmd += ' ' + std::to_string(nkeys) + ' ' + std::to_string(value_bytes) + ' ';
+    cmd += quoted(out);
+#ifdef _WIN32
+    cmd = '"' + cmd + '"';   // cmd.exe снимает внешние кавычки
+#endif
+    if (std::system(cmd.c_str()) != 0) return false;
+    std::ifstream f(out);
+    const bool ok = static_cast<bool>(f >> set_ns >> get_ns);
+    f.close();
+    std::filesystem::remove(out);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 6 && std::string(argv[1]) == "--trial")
+        return trial(argv[2], std::stoull(argv[3]), std::stoul(argv[4]), argv[5]);
+
+    const std::filesystem::path dir = argc > 1 ? argv[1] : "./bench_metrics";
+    const uint64_t nkeys     = argc > 2 ? std::stoull(argv[2]) : 2000;
+    const size_t value_bytes = argc > 3 ? std::stoul(argv[3]) : 100;
+    const int trials         = argc > 4 ? std::stoi(argv[4]) : 40;
+
+    // соседний бинарник: <stem>_bare<ext> для инструментированного и наоборот
+    const std::filesystem::path self = std::filesystem::absolute(argv[0]);
+    std::string stem = self.stem().string();
+    const std::string suffix = "_bare";
+    const bool self_bare = stem.size() > suffix.size() &&
+                           stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0;
+    const std::string other_stem = self_bare ? stem.substr(0, stem.size() - suffix.size())
+                                             : stem + suffix;
+    const std::filesystem::path other = self.parent_path() / (other_stem + self.extension().string());
+    const std::filesystem::path exe[2] = { self_bare ? self : other, self_bare ? other : self };  // [0] bare, [1] on
+
+    std::vector<double> set_ns[2], get_ns[2];
+    for (int t = 0; t < trials; ++t) {
+        double s[2], g[2];
+        for (int i = 0; i < 2; ++i) {
+            const int on = (t + i) % 2;
+            if (!run_trial(exe[on], dir, nkeys, value_bytes, s[on], g[on])) {
+                std::fprintf(stderr, "trial failed: %s\n", exe[on].string().c_str());
+                return 1;
+            }
+        }
+        for (int on = 0; on < 2; ++on) {
+            set_ns[on].push_back(s[on]);
+            get_ns[on].push_back(g[on]);
+        }
+    }
+
+    auto row = [](const char* op, const std::vector<double>* v) {
+        const double bare = median(v[0]), on = median(v[1]);
+        std::printf("%-4s %12.1f %12.1f %9.2f%%\n", op, bare, on, (on / bare - 1.0) * 100.0);
+    };
+    std::printf("keys=%llu value=%zuB trials=%d\n",
+                static_cast<unsigned long long>(nkeys), value_bytes, trials);
+    std::printf("%-4s %12s %12s %10s\n", "op", "bare_ns/op", "on_ns/op", "overhead");
+    row("SET", set_ns);
+    row("GET", get_ns);
+    return 0;
+}
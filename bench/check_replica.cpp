@@ -0,0 +1,224 @@
+// Проверка репликации в двух процессах: primary и реплика.
+//
+//   check_replica [dir] [keys]
+//
+// Драйвер держит реплику у себя, а каждый шаг primary выполняет отдельным
+// процессом (тот же бинарник с --primary): записи, DEL, compaction,
+// checkpoint, «авария» с оставшимися на диске поглощёнными сегментами и
+// рестарт primary. Те же операции драйвер применяет к модели и после
+// каждого шага сверяет с ней primary, реплику (после wait_for_seq) и
+// каталог checkpoint'а. Код возврата 0 — всё совпало.
+#include "kv/kvstore.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Model = std::vector<std::optional<std::string>>;
+
+constexpr int kSteps = 6;
+
+std::string key_of(uint64_t i) { return "key:" + std::to_string(i); }
+
+// Операции шага над ключами 0..n-1; primary и модель получают одно и то же.
+template <class Set, class Del>
+void ops(int step, uint64_t n, Set&& set, Del&& del) {
+    for (uint64_t i = 0; i < n; ++i) {
+        const std::string v = std::to_string(step) + ":" + std::to_string(i);
+        switch (step) {
+        case 1: set(i, v); break;
+        case 2: if (i % 3 == 0) del(i); else if (i % 5 == 0) set(i, v); break;
+        case 3: if (i % 7 == 1) del(i); break;                        // + compact
+        case 4: if (i % 2 == 0) set(i, v); break;                     // + checkpoint
+        case 5: if (i % 11 == 2) del(i); else if (i % 4 == 1) set(i, v); break; // + авария
+        case 6: if (i % 13 == 0) set(i, v); break;                    // рестарт primary
+        }
+    }
+}
+
+const char* step_name(int step) {
+    static const char* names[] = { "", "set", "del", "compact", "checkpoint",
+                                   "crash-after-compact", "primary-restart" };
+    return names[step];
+}
+
+Config primary_config(const std::filesystem::path& dir) {
+    Config cfg;
+    cfg.data_dir = dir;
+    cfg.segment_max_bytes = 16 * 1024;   // несколько сегментов на шаг
+    cfg.fsync_each_write = false;
+    return cfg;
+}
+
+// Шаг primary в отдельном процессе. Пишет в out last_seq и живые ключи.
+int primary_step(const std::filesystem::path& dir, int step, uint64_t n,
+                 const std::filesystem::path& out, const std::filesystem::path& ckpt)
+{
+    // Авария посреди checkpoint'а: сегменты, которые он держал, переживают
+    // compaction. Сохраняем их до шага и возвращаем после compact().
+    const std::filesystem::path stash = dir.string() + ".stash";
+    std::vector<std::filesystem::path> pinned;
+    if (step == 5) {
+        std::filesystem::remove_all(stash);
+        std::filesystem::create_directories(stash);
+        for (auto& e : std::filesystem::directory_iterator(dir)) {
+            if (e.path().extension() != ".log") continue;
+            std::filesystem::copy_file(e.path(), stash / e.path().filename());
+            pinned.push_back(e.path().filename());
+        }
+    }
+
+    KVStore db(primary_config(dir));
+    ops(step, n, [&](uint64_t i, const std::string& v){ db.set(key_of(i), v); },
+                 [&](uint64_t i){ db.del(key_of(i)); });
+    if (step == 3 || step == 5) {
+        if (auto ec = db.compact(); ec) { std::fprintf(stderr, "compact: %s\n", ec.message().c_str()); return 1; }
+    }
+    if (step == 4) {
+        std::filesystem::remove_all(ckpt);
+        if (auto ec = db.checkpoint(ckpt); ec) { std::fprintf(stderr, "checkpoint: %s\n", ec.message().c_str()); return 1; }
+    }
+
+    {
+        std::ofstream f(out, std::ios::trunc);
+        f << db.last_seq() << '\n';
+        for (uint64_t i = 0; i < n; ++i)
+            if (auto v = db.get(key_of(i))) f << i << ' ' << *v << '\n';
+        if (!f) return 1;
+    }
+
+    if (step == 5) {
+        // то, что осталось бы на диске: поглощённые сегменты рядом с
+        // выходным и их список в NNNNNN.drop; процесс падает, не закрывшись
+        uint32_t out_id = 0;
+        for (auto& e : std::filesystem::directory_iterator(dir))
+            if (e.path().extension() == ".log")
+                out_id = std::max<uint32_t>(out_id, std::stoul(e.path().stem().string()));
+        std::ofstream drop(dir / std::format("{:06}.drop", out_id), std::ios::trunc);
+        drop << "superseded";
+        for (auto& name : pinned) {
+            std::filesystem::copy_file(stash / name, dir / name,
+                                       std::filesystem::copy_options::overwrite_existing);
+            drop << ' ' << std::stoul(name.stem().string());
+        }
+        drop << '\n';
+        drop.close();
+        std::filesystem::remove_all(stash);
+        std::fflush(nullptr);
+        std::_Exit(drop ? 0 : 1);
+    }
+    return 0;
+}
+
+bool run_primary(const std::filesystem::path& exe, const std::filesystem::path& pdir, int step,
+                 uint64_t n, const std::filesystem::path& out, const std::filesystem::path& ckpt)
+{
+    auto quoted = [](const std::filesystem::path& p) { return '"' + p.string() + '"'; };
+    std::string cmd = quoted(exe);
+    cmd += " --primary ";
+    cmd += quoted(pdir);
+    cmd += ' ' + std::to_string(step) + ' ' + std::to_string(n) + ' ';
+    cmd += quoted(out);
+    cmd += ' ';
+    cmd += quoted(ckpt);
+#ifdef _WIN32
+    cmd = '"' + cmd + '"';   // cmd.exe снимает внешние кавычки
+#endif
+    return std::system(cmd.c_str()) == 0;
+}
+
+// Первое расхождение с моделью или пустая строка.
+template <class Get>
+std::string diff(const Model& m, Get&& get) {
+    for (uint64_t i = 0; i < m.size(); ++i) {
+        auto v = get(i);
+        if (v != m[i])
+            return std::format("{}: want {}, got {}", key_of(i),
+                               m[i] ? *m[i] : "(nil)", v ? *v : "(nil)");
+    }
+    return {};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 7 && std::string(argv[1]) == "--primary")
+        return primary_step(argv[2], std::stoi(argv[3]), std::stoull(argv[4]), argv[5], argv[6]);
+
+    const std::filesystem::path base = argc > 1 ? argv[1] : "./check_replica";
+    const uint64_t n = argc > 2 ? std::stoull(argv[2]) : 2000;
+    const std::filesystem::path exe = std::filesystem::absolute(argv[0]);
+    const auto pdir = base / "primary", rdir = base / "replica", ckpt = base / "checkpoint";
+    const auto out = base / "primary.out";
+
+    std::filesystem::remove_all(base);
+    std::filesystem::create_directories(pdir);
+
+    Config rcfg;
+    rcfg.data_dir = rdir;
+    rcfg.replica_of = pdir;
+    rcfg.replica_poll_ms = 250;  // шаг primary обычно целиком укладывается между опросами
+    rcfg.fsync_each_write = false;
+    auto replica = std::make_unique<KVStore>(rcfg);
+
+    Model model(n);
+    int failed = 0;
+    auto check = [&](const char* what, const std::string& d) {
+        std::printf("  %-28s %s\n", what, d.empty() ? "ok" : d.c_str());
+        if (!d.empty()) ++failed;
+    };
+    auto check_replica = [&](uint64_t seq) {
+        if (!replica->wait_for_seq(seq, std::chrono::seconds(30))) {
+            check("replica wait_for_seq", std::format("timeout at seq {}", seq));
+            return;
+        }
+        check("replica", diff(model, [&](uint64_t i){ return replica->get(key_of(i)); }));
+    };
+
+    uint64_t seq = 0;
+    for (int step = 1; step <= kSteps; ++step) {
+        ops(step, n, [&](uint64_t i, const std::string& v){ model[i] = v; },
+                     [&](uint64_t i){ model[i].reset(); });
+        std::printf("step %d %s\n", step, step_name(step));
+        if (!run_primary(exe, pdir, step, n, out, ckpt)) {
+            check("primary process", "failed");
+            break;
+        }
+
+        Model got(n);
+        std::ifstream f(out);
+        f >> seq;
+        for (uint64_t i; f >> i;) { f.get(); std::string v; std::getline(f, v); got[i] = v; }
+        check("primary", diff(model, [&](uint64_t i){ return got[i]; }));
+
+        if (step == 4) {
+            KVStore copy(primary_config(ckpt));
+            check("checkpoint", diff(model, [&](uint64_t i){ return copy.get(key_of(i)); }));
+        }
+        check_replica(seq);
+    }
+
+    // рестарт реплики: до конца первой сверки seq не публикуется, а
+    // compaction на реплике запрещён (он отбросил бы tombstone'ы)
+    std::printf("step %d replica-restart\n", kSteps + 1);
+    replica.reset();
+    replica = std::make_unique<KVStore>(rcfg);
+    try {
+        (void)replica->compact();
+        check("replica compact()", "did not throw");
+    } catch (const std::logic_error&) {
+        check("replica compact()", "");
+    }
+    check_replica(seq);
+    replica.reset();
+
+    std::printf(failed ? "FAILED (%d)\n" : "OK\n", failed);
+    if (!failed) std::filesystem::remove_all(base);
+    return failed ? 1 : 0;
+}
@@ -3,6 +3,12 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+
+// compaction пишет выходной сегмент пачками такого размера
+static constexpr size_t kCompactBatchBytes = 1u << 20;
+// реплика применяет записи primary пачками такого размера
+static constexpr size_t kReplBatchBytes = 1u << 20;
 
 static std::filesystem::path hint_path_for(const std::filesystem::path& seg_path) {
     auto p = seg_path;
@@ -10,12 +16,152 @@ static std::filesystem::path hint_path_for(const std::filesystem::path& seg_path
     return p;
 }
 
+static constexpr uint32_t kHintMagic = 0x314E5448u; // 'HNT1'
+static constexpr uint8_t  kHintVer   = 2;
+
+// Заголовок hint: magic, версия, id сегмента и логический размер сегмента,
+// по которому hint построен.
+static bool read_hint_header(std::ifstream& in, uint32_t id, uint64_t& seg_bytes) {
+    uint32_t magic=0; in.read(reinterpret_cast<char*>(&magic),4);
+    uint8_t ver=0; in.read(reinterpret_cast<char*>(&ver),1);
+    uint32_t file_id=0; in.read(reinterpret_cast<char*>(&file_id),4);
+    in.read(reinterpret_cast<char*>(&seg_bytes),8);
+    return in && magic == kHintMagic && ver == kHintVer && file_id == id;
+}
+
+// hint покрывает сегмент целиком, только если сегмент с тех пор не рос.
+// mtime для этого не годится: при грубой гранулярности времени дозапись
+// сразу после записи hint'а даёт равные метки.
+static bool hint_is_fresh(const std::filesystem::path& seg_path, uint32_t id) {
+    std::ifstream in(hint_path_for(seg_path), std::ios::binary);
+    if (!in) return false;
+    uint64_t seg_bytes = 0;
+    if (!read_hint_header(in, id, seg_bytes)) return false;
+    std::error_code ec;
+    const auto sz = std::filesystem::file_size(seg_path, ec);
+    return !ec && sz == seg_bytes;
+}
+
+// id сегментов NNNNNN.log в каталоге, по возрастанию
+static std::vector<uint32_t> list_segment_ids(const std::filesystem::path& dir) {
+    std::vector<uint32_t> ids;
+    for (auto& e : std::filesystem::directory_iterator(dir)) {
+        if (!e.is_regular_file()) continue;
+        auto name = e.path().filename().wstring();
+        if (name.size()==10 && name.ends_with(L".log")) {
+            try {
+                uint32_t id = std::stoul(std::wstring(name.begin(), name.begin()+6));
+                ids.push_back(id);
+            } catch(...) {}
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// Список сегментов, поглощённых compaction'ом в сегмент NNNNNN.log. Живёт,
+// пока они не удалены с диска (удаление откладывает checkpoint).
+static std::filesystem::path drop_path_for(const std::filesystem::path& seg_path) {
+    auto p = seg_path;
+    p.replace_extension(".drop");
+    return p;
+}
+
+static bool write_drop_list(const std::filesystem::path& path, const std::vector<uint32_t>& ids) {
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << "superseded";
+        for (auto id : ids) out << ' ' << id;
+        out << '\n';
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+// Объединение всех .drop в каталоге. Файл пишется только после успешной
+// compaction, поэтому верен, даже если сам выходной сегмент позже поглотила
+// следующая compaction.
+static std::vector<uint32_t> superseded_ids(const std::filesystem::path& dir,
+                                            std::vector<std::filesystem::path>* lists = nullptr) {
+    std::vector<uint32_t> ids;
+    for (auto& e : std::filesystem::directory_iterator(dir)) {
+        if (!e.is_regular_file() || e.path().extension() != ".drop") continue;
+        std::ifstream in(e.path());
+        std::string tag;
+        if (!(in >> tag) || tag != "superseded") continue;
+        for (uint32_t id; in >> id;) ids.push_back(id);
+        if (lists) lists->push_back(e.path());
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+// последняя запись каждого ключа в сегменте; end — логический конец сегмента
+static std::unordered_map<std::string, Location> last_records(const LogSegment& seg, uint64_t& end) {
+    std::unordered_map<std::string, Location> last_in_seg;
+    end = seg.scan([&](std::string&& key, Location loc, const char*, uint32_t){
+        auto it = last_in_seg.find(key);
+        if (it == last_in_seg.end() || it->second.seq < loc.seq) {
+            last_in_seg.insert_or_assign(std::move(key), loc);
+        }
+    });
+    return last_in_seg;
+}
+
+// Пишем во временный файл и переименовываем: hint может быть жёсткой
+// ссылкой из checkpoint, перезапись на месте испортила бы копию.
+static void write_hint_file(const std::filesystem::path& hpath, uint32_t id, uint64_t seg_bytes,
+    const std::unordered_map<std::string, Location>& last_in_seg)
+{
+    auto tmp = hpath;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+        auto wr_u32 = [&](uint32_t v){ out.write(reinterpret_cast<const char*>(&v),4); };
+        auto wr_u64 = [&](uint64_t v){ out.write(reinterpret_cast<const char*>(&v),8); };
+
+        wr_u32(kHintMagic);
+        out.write(reinterpret_cast<const char*>(&kHintVer),1);
+        wr_u32(id);
+        wr_u64(seg_bytes);
+        wr_u32(static_cast<uint32_t>(last_in_seg.size()));
+        for (auto& [key, loc] : last_in_seg) {
+            wr_u64(loc.seq);
+            uint8_t tomb = loc.tombstone ? 1 : 0; out.write(reinterpret_cast<const char*>(&tomb),1);
+            wr_u32(static_cast<uint32_t>(key.size()));
+            wr_u32(loc.record_size);
+            wr_u64(loc.offset);
+            if (!key.empty()) out.write(key.data(), static_cast<std::streamsize>(key.size()));
+        }
+        if (!out) return;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, hpath, ec);
+}
+
 KVStore::KVStore(Config cfg) : cfg_(std::move(cfg)) {
     std::filesystem::create_directories(cfg_.data_dir);
     bootstrap_();
+    if (is_replica()) repl_thread_ = std::thread([this]{ replica_loop_(); });
 }
 
-KVStore::~KVStore() = default;
+KVStore::~KVStore() {
+    if (repl_thread_.joinable()) {
+        {
+            std::scoped_lock g(repl_mu_);
+            repl_stop_.store(true);
+        }
+        repl_cv_.notify_all();
+        repl_thread_.join();
+    }
+}
 
 std::filesystem::path KVStore::seg_path_(uint32_t id) const {
     auto name = std::format("{:06}.log", id);
@@ -27,27 +173,16 @@ uint32_t KVStore::next_segment_id_() const {
     return segment_ids_.back() + 1;
 }
 
-bool KVStore::load_hint_(uint32_t id, uint64_t& max_seq) {
-    auto hpath = hint_path_for(seg_path_(id));
-    if (!std::filesystem::exists(hpath)) return false;
-    try {
-        auto ht = std::filesystem::last_write_time(hpath);
-        auto lt = std::filesystem::last_write_time(seg_path_(id));
-        if (ht < lt) return false;
-    } catch(...) { return false; }
-
-    std::ifstream in(hpath, std::ios::binary);
+bool KVStore::load_hint_(uint32_t id, uint64_t& max_seq, uint64_t& seg_bytes) {
+    auto spath = seg_path_(id);
+    std::ifstream in(hint_path_for(spath), std::ios::binary);
     if (!in) return false;
     auto rd_u32 = [&](uint32_t& v){ in.read(reinterpret_cast<char*>(&v), 4); };
     auto rd_u64 = [&](uint64_t& v){ in.read(reinterpret_cast<char*>(&v), 8); };
 
-    uint32_t magic=0; rd_u32(magic);
-    if (magic != 0x314E5448u) return false; // 'HNT1'
-    uint8_t ver=0; in.read(reinterpret_cast<char*>(&ver),1);
-    if (ver != 1) return false;
-
-    uint32_t file_id=0; rd_u32(file_id);
-    if (file_id != id) return false;
+    if (!read_hint_header(in, id, seg_bytes)) return false;
+    std::error_code ec;
+    if (std::filesystem::file_size(spath, ec) != seg_bytes || ec) return false;
 
     uint32_t count=0; rd_u32(count);
 
@@ -70,82 +205,73 @@ bool KVStore::load_hint_(uint32_t id, uint64_t& max_seq) {
     return true;
 }
 
-void KVStore::write_hint_(uint32_t id,
+void KVStore::write_hint_(uint32_t id, uint64_t seg_bytes,
     const std::unordered_map<std::string, Location>& last_in_seg)
 {
-    auto hpath = hint_path_for(seg_path_(id));
-    std::ofstream out(hpath, std::ios::binary | std::ios::trunc);
-    if (!out) return;
-    auto wr_u32 = [&](uint32_t v){ out.write(reinterpret_cast<const char*>(&v),4); };
-    auto wr_u64 = [&](uint64_t v){ out.write(reinterpret_cast<const char*>(&v),8); };
-
-    wr_u32(0x314E5448u); // 'HNT1'
-    uint8_t ver=1; out.write(reinterpret_cast<const char*>(&ver),1);
-    wr_u32(id);
-    wr_u32(static_cast<uint32_t>(last_in_seg.size()));
-    for (auto& [key, loc] : last_in_seg) {
-        wr_u64(loc.seq);
-        uint8_t tomb = loc.tombstone ? 1 : 0; out.write(reinterpret_cast<const char*>(&tomb),1);
-        wr_u32(static_cast<uint32_t>(key.size()));
-        wr_u32(loc.record_size);
-        wr_u64(loc.offset);
-        if (!key.empty()) out.write(key.data(), static_cast<std::streamsize>(key.size()));
-    }
+    write_hint_file(hint_path_for(seg_path_(id)), id, seg_bytes, last_in_seg);
 }
 
 void KVStore::bootstrap_() {
-    segment_ids_.clear();
-    for (auto& e : std::filesystem::directory_iterator(cfg_.data_dir)) {
-        if (!e.is_regular_file()) continue;
-        auto name = e.path().filename().wstring();
-        if (name.size()==10 && name.ends_with(L".log")) {
-            try {
-                uint32_t id = std::stoul(std::wstring(name.begin(), name.begin()+6));
-                segment_ids_.push_back(id);
-            } catch(...) {}
-        }
+    const uint64_t t0 = metrics_now_ns();
+    // Сегменты, которые compaction не успел удалить до остановки (их держал
+    // checkpoint). Читать их нельзя: compaction сохраняет исходные seq и
+    // отбрасывает tombstone'ы, и старый SET воскресил бы удалённый ключ.
+    {
+        std::vector<std::filesystem::path> lists;
+        bool removed = true;
+        for (auto id : superseded_ids(cfg_.data_dir, &lists)) removed &= !remove_segment_files_(id);
+        std::error_code ec;
+        if (removed) for (auto& p : lists) std::filesystem::remove(p, ec);
     }
-    std::sort(segment_ids_.begin(), segment_ids_.end());
+    segment_ids_ = list_segment_ids(cfg_.data_dir);
     index_.clear();
     uint64_t max_seq = 0;
+    // логический конец последнего сегмента: он станет active_, и
+    // open_for_append не придётся сканировать его второй раз
+    uint64_t end = LogSegment::kUnknownEnd;
 
     for (auto id : segment_ids_) {
-        if (load_hint_(id, max_seq)) continue;
+        if (load_hint_(id, max_seq, end)) continue;
 
-        std::unordered_map<std::string, Location> last_in_seg;
         LogSegment seg(id, seg_path_(id));
-        seg.open_readonly();
-        seg.scan([&](std::string&& key, Location loc, const char*, uint32_t){
-            auto it = last_in_seg.find(key);
-            if (it == last_in_seg.end() || it->second.seq < loc.seq) {
-                last_in_seg.emplace(std::move(key), loc);
-            }
-        });
+        seg.open_readonly(cfg_.direct_io);
+        auto last_in_seg = last_records(seg, end);
         for (auto& [key, loc] : last_in_seg) {
             auto it = index_.find(key);
             if (it == index_.end() || it->second.loc.seq < loc.seq) index_[key] = Meta{ loc };
             if (loc.seq > max_seq) max_seq = loc.seq;
         }
-        write_hint_(id, last_in_seg);
+        write_hint_(id, end, last_in_seg);
     }
 
-    seq_.store(max_seq);
+    // Реплика публикует seq только после первой сверки с primary: её
+    // собственный лог мог отстать или оборваться посреди сверки, и
+    // wait_for_seq отпустил бы читателя раньше DEL'ов.
+    seq_.store(is_replica() ? 0 : max_seq);
 
     uint32_t active_id = segment_ids_.empty() ? 1 : segment_ids_.back();
     if (segment_ids_.empty() || !std::filesystem::exists(seg_path_(active_id))) {
         active_id = 1;
         segment_ids_.push_back(active_id);
+        end = LogSegment::kUnknownEnd;
     }
     active_ = std::make_unique<LogSegment>(active_id, seg_path_(active_id));
-    active_->open_for_append();
+    active_->open_for_append(false, end);
+
+    last_bootstrap_ns_ = metrics_now_ns() - t0;
+    metrics_record(metrics().bootstrap_ns, last_bootstrap_ns_);
 }
 
 void KVStore::roll_segment_if_needed_() {
     if (active_->size_bytes() < cfg_.segment_max_bytes) return;
+    roll_segment_();
+}
+
+void KVStore::roll_segment_() {
     uint32_t id = next_segment_id_();
     segment_ids_.push_back(id);
     active_ = std::make_unique<LogSegment>(id, seg_path_(id));
-    active_->open_for_append();
+    active_->open_for_append(false);
 }
 
 void KVStore::flush() {
@@ -154,7 +280,9 @@ void KVStore::flush() {
 }
 
 void KVStore::set(std::string_view key, std::string_view value) {
-    std::unique_lock lk(mu_);
+    if (is_replica()) throw std::logic_error("read-only replica");
+    std::unique_lock lk(mu_, std::defer_lock);
+    { ScopedTimer t(metrics().lock_wait_exclusive_ns); lk.lock(); }
     roll_segment_if_needed_();
     const uint64_t seq = seq_.fetch_add(1, std::memory_order_relaxed) + 1;
     auto loc = active_->append(OpCode::SET, seq, key, value, cfg_.fsync_each_write);
@@ -162,7 +290,9 @@ void KVStore::set(std::string_view key, std::string_view value) {
 }
 
 bool KVStore::del(std::string_view key) {
-    std::unique_lock lk(mu_);
+    if (is_replica()) throw std::logic_error("read-only replica");
+    std::unique_lock lk(mu_, std::defer_lock);
+    { ScopedTimer t(metrics().lock_wait_exclusive_ns); lk.lock(); }
     auto it = index_.find(std::string(key));
     if (it == index_.end() || it->second.loc.tombstone) return false;
     roll_segment_if_needed_();
@@ -176,6 +306,7 @@ LogSegment& KVStore::ro_segment_(uint32_t id) const {
     std::scoped_lock g(cache_mu_);
     auto it = ro_cache_.find(id);
     if (it != ro_cache_.end()) return *(it->second);
+    metrics_add(metrics().ro_cache_misses);
     auto seg = std::make_unique<LogSegment>(id, const_cast<KVStore*>(this)->seg_path_(id));
     seg->open_readonly();
     auto& ref = *seg;
@@ -184,64 +315,445 @@ LogSegment& KVStore::ro_segment_(uint32_t id) const {
 }
 
 std::optional<std::string> KVStore::get(std::string_view key) const {
-    std::shared_lock lk(mu_);
+    ScopedTimer timer(metrics().get_ns);
+    std::shared_lock lk(mu_, std::defer_lock);
+    { ScopedTimer t(metrics().lock_wait_shared_ns, timer); lk.lock(); }
     auto it = index_.find(std::string(key));
-    if (it == index_.end() || it->second.loc.tombstone) return std::nullopt;
+    if (it == index_.end() || it->second.loc.tombstone) {
+        metrics_add(metrics().get_misses);
+        return std::nullopt;
+    }
     auto& seg = ro_segment_(it->second.loc.file_id);
+    ScopedTimer t(metrics().read_value_ns, timer);
     return seg.read_value(it->second.loc);
 }
 
 std::error_code KVStore::compact() {
-    std::unique_lock lk(mu_);
+    // tombstone'ы реплики нужны: без них первая сверка после рестарта
+    // заново применила бы всю историю удалённых ключей
+    if (is_replica()) throw std::logic_error("read-only replica");
+    std::unique_lock lk(mu_, std::defer_lock);
+    { ScopedTimer t(metrics().lock_wait_exclusive_ns, false); lk.lock(); }
+    const uint64_t t0 = metrics_now_ns();
+    metrics_add(metrics().compactions);
 
     uint32_t new_id = next_segment_id_();
-    LogSegment out(new_id, seg_path_(new_id));
-    out.open_for_append();
+    auto out = std::make_unique<LogSegment>(new_id, seg_path_(new_id));
+    out->open_for_append(cfg_.direct_io);
 
     std::unordered_map<std::string, Location> last_in_new;
 
-    for (auto& [key, meta] : index_) {
-        if (meta.loc.tombstone) continue;
-        LogSegment seg(meta.loc.file_id, seg_path_(meta.loc.file_id));
-        seg.open_readonly();
-        auto val = seg.read_value(meta.loc);
+    // Сегменты читаем последовательно (scan крупными блоками) и переносим
+    // только записи, на которые указывает индекс, — вместо случайного
+    // read_value на каждый ключ.
+    // Tombstone'ы отбрасываем, кроме самой последней операции: так
+    // максимальный seq переживает compaction, и реплика не ждёт его вечно.
+    const uint64_t last_seq = seq_.load();
+    auto keep = [&](const Location& l){ return !l.tombstone || l.seq == last_seq; };
+    size_t live = 0;
+    for (auto& [key, meta] : index_) if (keep(meta.loc)) ++live;
 
-        const uint64_t seq = seq_.fetch_add(1, std::memory_order_relaxed) + 1;
-        auto nl = out.append(OpCode::SET, seq, key, val, cfg_.fsync_each_write);
-        meta.loc = nl;
-        last_in_new[key] = nl;
+    for (auto id : segment_ids_) {
+        LogSegment seg(id, seg_path_(id));
+        seg.open_readonly(cfg_.direct_io);
+        seg.scan([&](std::string&& key, Location loc, const char* val, uint32_t vlen){
+            auto it = index_.find(key);
+            if (it == index_.end()) return;
+            auto& meta = it->second;
+            if (!keep(meta.loc) || meta.loc.file_id != id || meta.loc.offset != loc.offset) return;
+
+            // seq сохраняем: реплики применяют записи по seq ключа, и
+            // пересеквенированный сегмент пришлось бы переносить целиком
+            auto nl = meta.loc.tombstone
+                ? out->stage(OpCode::DEL, loc.seq, key, {})
+                : out->stage(OpCode::SET, loc.seq, key, std::string_view(val, vlen));
+            meta.loc = nl;
+            last_in_new[std::move(key)] = nl;
+            if (out->staged_bytes() >= kCompactBatchBytes) out->flush_staged();
+        });
     }
-
-    active_.reset();
+    out->flush_staged(cfg_.fsync_each_write);
+    const uint64_t t_copied = metrics_now_ns();
+    metrics_record(metrics().compact_copy_ns, t_copied - t0);
+
+    // выходной сегмент становится активным; direct-дескриптор меняем на
+    // buffered (закрытие срезает padding последнего блока)
+    if (cfg_.direct_io) {
+        const uint64_t end = out->size_bytes();
+        out.reset();
+        out = std::make_unique<LogSegment>(new_id, seg_path_(new_id));
+        out->open_for_append(false, end);
+    }
+    active_ = std::move(out);
     segment_ids_.push_back(new_id);
-    active_ = std::make_unique<LogSegment>(new_id, seg_path_(new_id));
-    active_->open_for_append();
+
+    // scan не дошёл до части живых записей (битый хвост?) — старые сегменты
+    // ещё нужны индексу, ничего не удаляем
+    if (last_in_new.size() != live) {
+        std::cerr << "Compaction moved " << last_in_new.size() << " of " << live << " records\n";
+        return std::make_error_code(std::errc::io_error);
+    }
+
+    write_hint_(new_id, active_->size_bytes(), last_in_new);
 
     std::vector<uint32_t> to_remove;
     for (auto id : segment_ids_) if (id != new_id) to_remove.push_back(id);
-    std::error_code ec;
-    for (auto id : to_remove) {
-        auto spath = seg_path_(id);
-        std::filesystem::remove(spath, ec);
-        if (ec) {
-            std::cerr << "Failed to remove segment " << spath << ": " << ec.message() << '\n';
-            return ec;
-        }
-        auto hpath = hint_path_for(spath);
-        std::filesystem::remove(hpath, ec);
-        if (ec) {
-            std::cerr << "Failed to remove hint file " << hpath << ": " << ec.message() << '\n';
-            return ec;
-        }
+    // список поглощённых сегментов — на диск до удаления: если процесс упадёт
+    // раньше, чем они исчезнут, bootstrap_ удалит их сам
+    const auto drop_path = drop_path_for(seg_path_(new_id));
+    if (!write_drop_list(drop_path, to_remove)) {
+        std::cerr << "Failed to write " << drop_path << '\n';
+        return std::make_error_code(std::errc::io_error);
     }
     segment_ids_.clear();
     segment_ids_.push_back(new_id);
 
-    write_hint_(new_id, last_in_new);
+    bool deferred = false;
+    for (auto id : to_remove) {
+        // сегмент ещё ссылается незавершённый checkpoint — удалит он сам
+        if (pins_.count(id)) { pending_remove_.push_back(id); deferred = true; continue; }
+        if (auto ec = remove_segment_files_(id); ec) return ec;
+    }
+    std::error_code ec;
+    if (deferred) drop_lists_.push_back(new_id);
+    else std::filesystem::remove(drop_path, ec);
 
     {
         std::scoped_lock g(cache_mu_);
         ro_cache_.clear();
     }
+    const uint64_t t1 = metrics_now_ns();
+    metrics_record(metrics().compact_cleanup_ns, t1 - t_copied);
+    last_compact_ns_ = t1 - t0;
+    return {};
+}
+
+std::error_code KVStore::remove_segment_files_(uint32_t id) const {
+    std::error_code ec;
+    auto spath = seg_path_(id);
+    std::filesystem::remove(spath, ec);
+    if (ec) {
+        std::cerr << "Failed to remove segment " << spath << ": " << ec.message() << '\n';
+        return ec;
+    }
+    auto hpath = hint_path_for(spath);
+    std::filesystem::remove(hpath, ec);
+    if (ec) {
+        std::cerr << "Failed to remove hint file " << hpath << ": " << ec.message() << '\n';
+        return ec;
+    }
+    return {};
+}
+
+Stats KVStore::stats() const {
+    Stats st;
+    {
+        std::shared_lock lk(mu_);
+        st.seq = seq_.load();
+        st.segments = segment_ids_.size();
+        for (auto& [key, meta] : index_) {
+            if (meta.loc.tombstone) continue;
+            ++st.keys;
+            st.live_bytes += meta.loc.record_size;
+        }
+        for (auto id : segment_ids_) {
+            if (active_ && id == active_->id()) { st.total_bytes += active_->size_bytes(); continue; }
+            std::error_code ec;
+            auto sz = std::filesystem::file_size(seg_path_(id), ec);
+            if (!ec) st.total_bytes += sz;
+        }
+        st.last_compact_ns = last_compact_ns_;
+        if (is_replica()) st.replica_lag = replica_status().lag;
+        st.last_bootstrap_ns = last_bootstrap_ns_;
+    }
+    st.dead_bytes = st.total_bytes > st.live_bytes ? st.total_bytes - st.live_bytes : 0;
+    st.metrics = metrics().snapshot();
+    return st;
+}
+
+std::error_code KVStore::dump_metrics(const std::filesystem::path& path) const {
+    const Stats st = stats();
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return std::make_error_code(std::errc::io_error);
+        auto gauge = [&](const char* name, auto v) {
+            out << "# TYPE minidb_" << name << " gauge\n"
+                << "minidb_" << name << ' ' << v << '\n';
+        };
+        out.precision(9);
+        gauge("seq", st.seq);
+        gauge("keys", st.keys);
+        gauge("segments", st.segments);
+        gauge("total_bytes", st.total_bytes);
+        gauge("live_bytes", st.live_bytes);
+        gauge("dead_bytes", st.dead_bytes);
+        gauge("last_compact_seconds", static_cast<double>(st.last_compact_ns) / 1e9);
+        gauge("last_bootstrap_seconds", static_cast<double>(st.last_bootstrap_ns) / 1e9);
+        if (is_replica()) gauge("replica_lag_seq", st.replica_lag);
+        metrics().write_prometheus(out);
+        if (!out) return std::make_error_code(std::errc::io_error);
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return ec;
+}
+
+// Жёсткая ссылка, если ФС позволяет; иначе копия (copy_file сам делает
+// reflink/copy_file_range там, где это поддерживается).
+static std::error_code link_or_copy(const std::filesystem::path& src, const std::filesystem::path& dst) {
+    std::error_code ec;
+    std::filesystem::create_hard_link(src, dst, ec);
+    if (!ec) return {};
+    ec.clear();
+    std::filesystem::copy_file(src, dst, std::filesystem::copy_options::overwrite_existing, ec);
+    return ec;
+}
+
+std::error_code KVStore::checkpoint(const std::filesystem::path& dir) {
+    const uint64_t t0 = metrics_now_ns();
+    std::error_code ec;
+    if (std::filesystem::exists(dir, ec) && !std::filesystem::is_empty(dir, ec))
+        return std::make_error_code(std::errc::file_exists);
+    std::filesystem::create_directories(dir, ec);
+    if (ec) return ec;
+
+    // писатели ждут только запечатывания active_; сегменты до среза
+    // пинятся, чтобы compaction не удалил их, пока мы ставим ссылки
+    std::vector<uint32_t> sealed;
+    uint64_t seq_cut = 0;
+    {
+        std::unique_lock lk(mu_, std::defer_lock);
+        { ScopedTimer t(metrics().lock_wait_exclusive_ns, false); lk.lock(); }
+        // без fsync_each_write хвост запечатываемого сегмента ещё в page cache
+        if (active_->size_bytes() > 0) {
+            active_->flush();
+            roll_segment_();
+        }
+        for (auto id : segment_ids_) {
+            if (id == active_->id()) continue;
+            sealed.push_back(id);
+            ++pins_[id];
+        }
+        seq_cut = seq_.load();
+    }
+
+    try {
+        ec = checkpoint_files_(dir, sealed, seq_cut);
+    } catch (const std::exception& e) {
+        std::cerr << "Checkpoint failed: " << e.what() << '\n';
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    std::vector<uint32_t> drop, lists;
+    {
+        std::unique_lock lk(mu_);
+        for (auto id : sealed) {
+            if (--pins_[id] == 0) pins_.erase(id);
+        }
+        std::erase_if(pending_remove_, [&](uint32_t id) {
+            if (pins_.count(id)) return false;
+            drop.push_back(id);
+            return true;
+        });
+        // .drop больше не нужны, когда отложенных удалений не осталось
+        if (pending_remove_.empty()) lists.swap(drop_lists_);
+    }
+    bool removed = true;
+    for (auto id : drop) removed &= !remove_segment_files_(id);
+    if (removed) {
+        std::error_code rec;
+        for (auto id : lists) std::filesystem::remove(drop_path_for(seg_path_(id)), rec);
+    }
+
+    metrics_record(metrics().checkpoint_ns, metrics_now_ns() - t0);
+    return ec;
+}
+
+std::error_code KVStore::checkpoint_files_(const std::filesystem::path& dir,
+    const std::vector<uint32_t>& sealed, uint64_t seq_cut) const
+{
+    // CHECKPOINTED — только когда всё на диске: сегменты (ссылка делит
+    // с источником inode, который мог не проходить fsync, копия — новый
+    // файл), hint'ы, пустой активный сегмент, MANIFEST и сам каталог.
+    // Ошибки sync_path — исключения, checkpoint() превращает их в io_error.
+    for (auto id : sealed) {
+        auto src = seg_path_(id);
+        auto dst = dir / src.filename();
+        if (auto ec = link_or_copy(src, dst); ec) return ec;
+        WinFile::sync_path(dst);
+
+        // hint ссылаем, если он покрывает сегмент целиком (в том числе
+        // запечатанный этим checkpoint'ом), иначе строим по связанной копии
+        if (hint_is_fresh(src, id)) {
+            if (auto ec = link_or_copy(hint_path_for(src), hint_path_for(dst)); ec) return ec;
+        } else {
+            LogSegment seg(id, dst);
+            seg.open_readonly(cfg_.direct_io);
+            uint64_t end = 0;
+            auto last_in_seg = last_records(seg, end);
+            write_hint_file(hint_path_for(dst), id, end, last_in_seg);
+        }
+        WinFile::sync_path(hint_path_for(dst));
+    }
+
+    // пустой активный сегмент: копия не должна дописывать в файлы,
+    // разделяемые с источником через жёсткие ссылки
+    const uint32_t active_id = sealed.empty() ? 1 : sealed.back() + 1;
+    const auto active_path = dir / seg_path_(active_id).filename();
+    {
+        std::ofstream out(active_path, std::ios::binary | std::ios::trunc);
+        if (!out) return std::make_error_code(std::errc::io_error);
+    }
+    WinFile::sync_path(active_path);
+
+    auto manifest = dir / "MANIFEST";
+    auto tmp = manifest;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return std::make_error_code(std::errc::io_error);
+        out << "minidb-checkpoint 1\n"
+            << "seq_cut " << seq_cut << '\n'
+            << "segments";
+        for (auto id : sealed) out << ' ' << id;
+        out << '\n';
+        if (!out) return std::make_error_code(std::errc::io_error);
+    }
+    WinFile::sync_path(tmp);
+    std::error_code ec;
+    std::filesystem::rename(tmp, manifest, ec);
+    if (ec) return ec;
+    WinFile::sync_path(dir);
     return {};
 }
+
+ReplicaStatus KVStore::replica_status() const {
+    ReplicaStatus rs;
+    rs.applied_seq = seq_.load();
+    rs.primary_seq = primary_seq_.load();
+    rs.lag = rs.primary_seq > rs.applied_seq ? rs.primary_seq - rs.applied_seq : 0;
+    rs.resyncs = repl_resyncs_.load();
+    return rs;
+}
+
+bool KVStore::wait_for_seq(uint64_t seq, std::chrono::milliseconds timeout) const {
+    std::unique_lock lk(repl_mu_);
+    return repl_cv_.wait_for(lk, timeout, [&]{ return seq_.load() >= seq; });
+}
+
+void KVStore::replica_loop_() {
+    while (!repl_stop_.load()) {
+        try {
+            replica_poll_();
+        } catch (const std::exception& e) {
+            // чаще всего compaction на primary удалил сегмент посреди чтения
+            std::cerr << "Replica poll failed: " << e.what() << '\n';
+            repl_resync_ = true;
+        }
+        std::unique_lock lk(repl_mu_);
+        repl_cv_.wait_for(lk, std::chrono::milliseconds(cfg_.replica_poll_ms),
+                          [&]{ return repl_stop_.load(); });
+    }
+}
+
+// Дочитывает сегменты primary с курсора (repl_file_, repl_off_). Если
+// курсорного сегмента больше нет (compaction на primary) или это первый
+// проход — читает всё заново и сверяет набор живых ключей: DEL, поглощённые
+// compaction'ом, иначе до реплики не дойдут. Сегменты из .drop primary
+// считаются удалёнными: их держит checkpoint, а более поздние, с теми самыми
+// DEL, compaction уже мог удалить — курсор на таком сегменте тоже ведёт к сверке.
+// Сверка — O(размер базы): весь живой набор primary читается и держится в
+// primary_last, так что частые compaction на primary дорого обходятся репликам.
+void KVStore::replica_poll_() {
+    auto ids = list_segment_ids(cfg_.replica_of);
+    // .drop пишется до удаления сегментов, поэтому читаем его после списка
+    const auto gone = superseded_ids(cfg_.replica_of);
+    std::erase_if(ids, [&](uint32_t id){ return std::binary_search(gone.begin(), gone.end(), id); });
+    if (ids.empty()) return;
+    const bool resync = repl_resync_ ||
+        std::find(ids.begin(), ids.end(), repl_file_) == ids.end();
+
+    struct Last { uint64_t seq; bool tombstone; };
+    std::unordered_map<std::string, Last> primary_last;
+    std::vector<ReplRecord> batch;
+    size_t batch_bytes = 0;
+    uint64_t seen = primary_seq_.load();
+
+    for (auto id : ids) {
+        if (!resync && id < repl_file_) continue;
+        const uint64_t from = (!resync && id == repl_file_) ? repl_off_ : 0;
+
+        LogSegment seg(id, cfg_.replica_of / seg_path_(id).filename());
+        seg.open_readonly(cfg_.direct_io);
+        const uint64_t end = seg.scan([&](std::string&& key, Location loc, const char* val, uint32_t vlen){
+            if (loc.seq > seen) seen = loc.seq;
+            if (resync) {
+                auto it = primary_last.find(key);
+                if (it == primary_last.end() || it->second.seq < loc.seq)
+                    primary_last.insert_or_assign(key, Last{ loc.seq, loc.tombstone });
+            }
+            batch_bytes += key.size() + vlen;
+            batch.push_back(ReplRecord{ loc.tombstone ? OpCode::DEL : OpCode::SET, loc.seq,
+                                        std::move(key), std::string(val ? val : "", vlen) });
+            if (batch_bytes >= kReplBatchBytes) {
+                apply_replicated_(batch);
+                if (!resync) publish_seq_(seen);
+                batch.clear();
+                batch_bytes = 0;
+            }
+        }, from);
+        repl_file_ = id;
+        repl_off_ = end;
+    }
+    apply_replicated_(batch);
+    if (seen > primary_seq_.load()) primary_seq_.store(seen);
+    // при сверке seq публикуем только после DEL'ов: иначе wait_for_seq
+    // отпустил бы читателя, пока удалённые на primary ключи ещё видны
+    if (!resync) { publish_seq_(seen); return; }
+
+    std::vector<ReplRecord> dels;
+    {
+        std::shared_lock lk(mu_);
+        for (auto& [key, meta] : index_) {
+            if (meta.loc.tombstone) continue;
+            auto it = primary_last.find(key);
+            if (it != primary_last.end() && !it->second.tombstone) continue;
+            dels.push_back(ReplRecord{ OpCode::DEL, std::max(seen, meta.loc.seq), key, {} });
+        }
+    }
+    apply_replicated_(dels, true);
+    publish_seq_(seen);
+    repl_resync_ = false;
+    repl_resyncs_.fetch_add(1);
+}
+
+// Запись primary применяется, только если она новее того, что реплика уже
+// знает о ключе (то же правило, что при слиянии сегментов в bootstrap_).
+// force — для DEL из сверки, у которых своего seq на primary нет.
+void KVStore::apply_replicated_(std::vector<ReplRecord>& batch, bool force) {
+    if (batch.empty()) return;
+    std::unique_lock lk(mu_, std::defer_lock);
+    { ScopedTimer t(metrics().lock_wait_exclusive_ns); lk.lock(); }
+    for (auto& r : batch) {
+        auto it = index_.find(r.key);
+        if (!force && it != index_.end() && it->second.loc.seq >= r.seq) continue;
+        if (r.op == OpCode::DEL && (it == index_.end() || it->second.loc.tombstone)) continue;
+
+        roll_segment_if_needed_();
+        auto loc = active_->append(r.op, r.seq, r.key, r.value, false);
+        if (it != index_.end()) it->second = Meta{ loc };
+        else index_.emplace(std::move(r.key), Meta{ loc });
+    }
+    if (cfg_.fsync_each_write) active_->flush();
+}
+
+// seq_ реплики — максимальный seq primary, до которого всё применено
+void KVStore::publish_seq_(uint64_t seq) {
+    if (seq > seq_.load()) seq_.store(seq);
+    {
+        std::scoped_lock g(repl_mu_);
+    }
+    repl_cv_.notify_all();
+}
@@ -9,12 +9,46 @@
 #include <shared_mutex>
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 #include "log_segment.h"
+#include "metrics.h"
 
 struct Config {
     std::filesystem::path data_dir = L"./data";
     uint64_t segment_max_bytes = 64ull * 1024 * 1024;
     bool fsync_each_write = true;
+    // O_DIRECT / FILE_FLAG_NO_BUFFERING для выходного сегмента compaction и
+    // scan'ов (старт, compaction, checkpoint, реплика). Активный сегмент
+    // всегда buffered: каждый SET в direct-режиме переписывал бы 4 KiB хвост
+    // синхронно. Точечные GET тоже идут через page cache.
+    bool direct_io = false;
+    // Реплика: каталог primary, из сегментов которого фоновый поток дочитывает
+    // новые записи в свой data_dir. SET/DEL/compact() запрещены. Пусто — обычный режим.
+    std::filesystem::path replica_of;
+    uint32_t replica_poll_ms = 50;
+};
+
+struct ReplicaStatus {
+    uint64_t applied_seq = 0;    // максимальный seq primary, дошедший до реплики
+    uint64_t primary_seq = 0;    // максимальный seq, увиденный в сегментах primary
+    uint64_t lag = 0;            // primary_seq - applied_seq
+    uint64_t resyncs = 0;        // полные сверки с primary (старт, compaction на primary)
+};
+
+// Снимок состояния хранилища: размеры на момент вызова + метрики процесса.
+struct Stats {
+    uint64_t seq = 0;
+    uint64_t keys = 0;           // без tombstone
+    uint64_t segments = 0;
+    uint64_t total_bytes = 0;    // сумма размеров сегментов
+    uint64_t live_bytes = 0;     // записи, на которые указывает индекс
+    uint64_t dead_bytes = 0;
+    uint64_t last_compact_ns = 0;
+    uint64_t last_bootstrap_ns = 0;
+    uint64_t replica_lag = 0;
+    MetricsSnapshot metrics;
 };
 
 class KVStore {
@@ -29,6 +63,23 @@ public:
     std::error_code compact();
     void flush();
 
+    // Онлайн-бэкап: запечатывает active_, ссылает (или копирует) сегменты
+    // до среза seq и их hint'ы в пустой dir, пишет MANIFEST. Результат
+    // открывается как обычный KVStore.
+    std::error_code checkpoint(const std::filesystem::path& dir);
+
+    // Последний выданный seq. Клиент primary передаёт его реплике в
+    // wait_for_seq, чтобы читать свои записи.
+    uint64_t last_seq() const { return seq_.load(); }
+    bool is_replica() const { return !cfg_.replica_of.empty(); }
+    ReplicaStatus replica_status() const;
+    // ждёт, пока реплика применит записи primary до seq включительно
+    bool wait_for_seq(uint64_t seq, std::chrono::milliseconds timeout) const;
+
+    Stats stats() const;
+    // Prometheus text format; пишется во временный файл и переименовывается
+    std::error_code dump_metrics(const std::filesystem::path& path) const;
+
 private:
     Config cfg_;
     mutable std::shared_mutex mu_;
@@ -40,6 +91,28 @@ private:
     std::unique_ptr<LogSegment> active_;
     std::atomic<uint64_t> seq_{0};
 
+    // сегменты, на которые ссылается незавершённый checkpoint; compaction
+    // откладывает их удаление в pending_remove_, а на диске список остаётся
+    // в NNNNNN.drop выходного сегмента (id этих сегментов — в drop_lists_)
+    std::unordered_map<uint32_t, uint32_t> pins_;
+    std::vector<uint32_t> pending_remove_;
+    std::vector<uint32_t> drop_lists_;
+
+    uint64_t last_compact_ns_ = 0;
+    uint64_t last_bootstrap_ns_ = 0;
+
+    // реплика: курсор по сегментам primary (только поток реплики)
+    struct ReplRecord { OpCode op; uint64_t seq; std::string key; std::string value; };
+    std::thread repl_thread_;
+    std::atomic<bool> repl_stop_{false};
+    mutable std::mutex repl_mu_;
+    mutable std::condition_variable repl_cv_;
+    uint32_t repl_file_ = 0;
+    uint64_t repl_off_ = 0;
+    bool repl_resync_ = true;
+    std::atomic<uint64_t> primary_seq_{0};
+    std::atomic<uint64_t> repl_resyncs_{0};
+
     // read-only сегменты кэшируем для быстрых GET
     mutable std::mutex cache_mu_;
     mutable std::unordered_map<uint32_t, std::unique_ptr<LogSegment>> ro_cache_;
@@ -49,10 +122,21 @@ private:
     uint32_t next_segment_id_() const;
     std::filesystem::path seg_path_(uint32_t id) const;
     void roll_segment_if_needed_();
+    void roll_segment_();
+    std::error_code remove_segment_files_(uint32_t id) const;
+    std::error_code checkpoint_files_(const std::filesystem::path& dir,
+                                      const std::vector<uint32_t>& sealed, uint64_t seq_cut) const;
+
+    // репликация
+    void replica_loop_();
+    void replica_poll_();
+    void apply_replicated_(std::vector<ReplRecord>& batch, bool force = false);
+    void publish_seq_(uint64_t seq);
 
     // hint
-    bool load_hint_(uint32_t id, uint64_t& max_seq);
-    void write_hint_(uint32_t id, const std::unordered_map<std::string, Location>& last_in_seg);
+    bool load_hint_(uint32_t id, uint64_t& max_seq, uint64_t& seg_bytes);
+    void write_hint_(uint32_t id, uint64_t seg_bytes,
+                     const std::unordered_map<std::string, Location>& last_in_seg);
 
     LogSegment& ro_segment_(uint32_t id) const;
 };
@@ -1,21 +1,36 @@
 #include "log_segment.h"
 #include "endian.h"
 #include "crc32.h"
+#include "metrics.h"
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 
 static constexpr uint32_t MAGIC = 0x314C564Bu; // 'KVL1' (LE)
 static constexpr uint8_t  VER   = 1;
+static constexpr uint32_t SCAN_CHUNK = 1u << 20; // окно чтения scan()
 
 LogSegment::LogSegment(uint32_t id, std::filesystem::path path)
     : id_(id), path_(std::move(path)) {}
 
-void LogSegment::open_for_append() { file_.open_append(path_); }
-void LogSegment::open_readonly()   { file_.open_readonly(path_); }
+void LogSegment::open_for_append(bool direct, uint64_t end) {
+    file_.open_append(path_, direct);
+    // после аварии в хвосте может остаться нулевой padding direct-записи
+    // (даже если сейчас открыли buffered или O_DIRECT не поддержан) или
+    // оборванная запись; scan на них остановится, и всё, что допишем
+    // дальше, потеряется при следующем старте. Срезаем до логического конца.
+    const uint64_t sz = file_.size();
+    if (sz == 0) return;
+    if (end == kUnknownEnd) end = scan([](std::string&&, Location, const char*, uint32_t){});
+    if (end != sz) file_.truncate(end);
+}
 
-Location LogSegment::append(OpCode op, uint64_t seq,
-                            std::string_view key, std::string_view value,
-                            bool do_fsync)
+void LogSegment::open_readonly(bool direct) { file_.open_readonly(path_, direct); }
+
+// Дописывает сериализованную запись в buf, возвращает её размер.
+static uint32_t encode_record(OpCode op, uint64_t seq,
+                              std::string_view key, std::string_view value,
+                              std::vector<unsigned char>& buf)
 {
     const uint32_t klen = static_cast<uint32_t>(key.size());
     const uint32_t vlen = (op==OpCode::SET) ? static_cast<uint32_t>(value.size()) : 0;
@@ -41,8 +56,7 @@ Location LogSegment::append(OpCode op, uint64_t seq,
     put_u32_le(c, hdr+24);
 
     const uint32_t rec_size = 28 + klen + vlen;
-    std::vector<unsigned char> buf;
-    buf.reserve(rec_size);
+    buf.reserve(buf.size() + rec_size);
     buf.insert(buf.end(), hdr, hdr+28);
     buf.insert(buf.end(), reinterpret_cast<const unsigned char*>(key.data()),
                            reinterpret_cast<const unsigned char*>(key.data()) + klen);
@@ -50,12 +64,40 @@ Location LogSegment::append(OpCode op, uint64_t seq,
         buf.insert(buf.end(), reinterpret_cast<const unsigned char*>(value.data()),
                                reinterpret_cast<const unsigned char*>(value.data()) + vlen);
     }
+    return rec_size;
+}
+
+Location LogSegment::append(OpCode op, uint64_t seq,
+                            std::string_view key, std::string_view value,
+                            bool do_fsync)
+{
+    ScopedTimer t(metrics().append_ns);
+    std::vector<unsigned char> buf;
+    const uint32_t rec_size = encode_record(op, seq, key, value, buf);
 
     const uint64_t off = file_.append(buf.data(), rec_size);
+    metrics_add(metrics().bytes_appended, rec_size);
     if (do_fsync) file_.flush();
     return Location{ id_, off, rec_size, seq, op==OpCode::DEL };
 }
 
+Location LogSegment::stage(OpCode op, uint64_t seq,
+                           std::string_view key, std::string_view value)
+{
+    const uint64_t off = file_.size() + staged_.size();
+    const uint32_t rec_size = encode_record(op, seq, key, value, staged_);
+    return Location{ id_, off, rec_size, seq, op==OpCode::DEL };
+}
+
+void LogSegment::flush_staged(bool do_fsync) {
+    if (!staged_.empty()) {
+        file_.append(staged_.data(), static_cast<uint32_t>(staged_.size()));
+        metrics_add(metrics().bytes_appended, staged_.size());
+        staged_.clear();
+    }
+    if (do_fsync) file_.flush();
+}
+
 std::string LogSegment::read_value(const Location& loc) const {
     unsigned char hdr[28];
     file_.read_at(loc.offset, hdr, 28);
@@ -72,14 +114,27 @@ std::string LogSegment::read_value(const Location& loc) const {
     return val;
 }
 
-void LogSegment::scan(std::function<void(std::string&&, Location, const char*, uint32_t)> cb) const {
-    uint64_t pos = 0;
+uint64_t LogSegment::scan(std::function<void(std::string&&, Location, const char*, uint32_t)> cb,
+                          uint64_t from) const {
+    uint64_t pos = from;
     const uint64_t end = file_.size();
 
-    std::vector<char> scratch;
+    // читаем окнами по SCAN_CHUNK вместо двух read_at на запись
+    std::vector<char> win;
+    uint64_t win_off = 0;
+    auto fetch = [&](uint64_t off, uint64_t n) -> const char* {
+        if (off < win_off || off + n > win_off + win.size()) {
+            const uint64_t len = std::min<uint64_t>(std::max<uint64_t>(n, SCAN_CHUNK), end - off);
+            win.resize(static_cast<size_t>(len));
+            file_.read_at(off, win.data(), static_cast<uint32_t>(len));
+            win_off = off;
+        }
+        return win.data() + (off - win_off);
+    };
+
+    std::vector<unsigned char> to_crc;
     while (pos + 28 <= end) {
-        unsigned char hdr[28];
-        file_.read_at(pos, hdr, 28);
+        const auto* hdr = reinterpret_cast<const unsigned char*>(fetch(pos, 28));
 
         if (get_u32_le(hdr+0) != MAGIC) break;
         if (hdr[4] != VER) break;
@@ -93,25 +148,24 @@ void LogSegment::scan(std::function<void(std::string&&, Location, const char*, u
         const uint64_t rec_size = 28ull + klen + vlen;
         if (pos + rec_size > end) break;
 
-        scratch.resize(klen + vlen);
-        if (klen + vlen)
-            file_.read_at(pos + 28, scratch.data(), klen + vlen);
+        const auto* rec = reinterpret_cast<const unsigned char*>(fetch(pos, rec_size));
+        const char* payload = reinterpret_cast<const char*>(rec + 28);
 
-        std::vector<unsigned char> to_crc;
-        to_crc.reserve(1+1+2+8+4+4 + klen + vlen);
-        to_crc.insert(to_crc.end(), hdr+4, hdr+24);
-        to_crc.insert(to_crc.end(), scratch.begin(), scratch.end());
+        to_crc.clear();
+        to_crc.insert(to_crc.end(), rec+4, rec+24);
+        to_crc.insert(to_crc.end(), rec+28, rec+rec_size);
         const uint32_t actual = crc32(to_crc.data(), to_crc.size());
         if (actual != crc) break;
 
         Location loc{ id_, pos, static_cast<uint32_t>(rec_size), seq, op==static_cast<uint8_t>(OpCode::DEL) };
         if (op == static_cast<uint8_t>(OpCode::SET)) {
-            cb(std::string(scratch.data(), klen), loc, scratch.data()+klen, vlen);
+            cb(std::string(payload, klen), loc, payload+klen, vlen);
         } else if (op == static_cast<uint8_t>(OpCode::DEL)) {
-            cb(std::string(scratch.data(), klen), loc, nullptr, 0);
+            cb(std::string(payload, klen), loc, nullptr, 0);
         } else {
             break;
         }
         pos += rec_size;
     }
+    return pos;
 }
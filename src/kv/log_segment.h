@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <cstdint>
 #include <functional>
+#include <vector>
 #include "win_file.h"
 
 enum class OpCode : uint8_t { SET=1, DEL=2 };
@@ -18,19 +19,35 @@ struct Location {
 
 class LogSegment {
 public:
+    static constexpr uint64_t kUnknownEnd = UINT64_MAX;
+
     explicit LogSegment(uint32_t id, std::filesystem::path path);
 
-    void open_for_append();
-    void open_readonly();
+    // direct=true — unbuffered I/O (см. WinFile), не засоряет page cache.
+    // end — логический конец сегмента, если он уже известен (hint или scan
+    // при старте); иначе непустой сегмент сканируется, чтобы его найти.
+    void open_for_append(bool direct = false, uint64_t end = kUnknownEnd);
+    void open_readonly(bool direct = false);
 
     Location append(OpCode op, uint64_t seq,
                     std::string_view key, std::string_view value,
                     bool do_fsync = false);
 
+    // Пакетная запись (compaction): stage() копит записи в памяти,
+    // flush_staged() пишет их одним append. До flush записи не читаются.
+    Location stage(OpCode op, uint64_t seq,
+                   std::string_view key, std::string_view value);
+    void flush_staged(bool do_fsync = false);
+    size_t staged_bytes() const { return staged_.size(); }
+
     std::string read_value(const Location& loc) const;
 
-    void scan(std::function<void(std::string&&, Location, const char*, uint32_t)> cb) const;
+    // читает записи начиная с from (граница записи); возвращает смещение
+    // конца последней валидной записи
+    uint64_t scan(std::function<void(std::string&&, Location, const char*, uint32_t)> cb,
+                  uint64_t from = 0) const;
 
+    void flush() { file_.flush(); }
     uint64_t size_bytes() const { return file_.size(); }
     uint32_t id() const { return id_; }
     const std::filesystem::path& path() const { return path_; }
@@ -39,4 +56,5 @@ private:
     uint32_t id_;
     std::filesystem::path path_;
     mutable WinFile file_;
+    std::vector<unsigned char> staged_;
 };
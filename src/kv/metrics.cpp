@@ -0,0 +1,188 @@
+#include "metrics.h"
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+struct CounterDef   { const char* name; uint64_t (*value)(const Metrics&); };
+struct HistogramDef { const char* name; Histogram Metrics::* field; bool sampled; };
+
+// имена без префикса minidb_ и суффиксов _total / _seconds
+constexpr CounterDef kCounters[] = {
+    { "appends",         [](const Metrics& m) { return m.append_ns.calls(); } },
+    { "appended_bytes",  [](const Metrics& m) { return m.bytes_appended.value(); } },
+    { "fsyncs",          [](const Metrics& m) { return m.fsync_ns.calls(); } },
+    { "gets",            [](const Metrics& m) { return m.get_ns.calls(); } },
+    { "get_misses",      [](const Metrics& m) { return m.get_misses.value(); } },
+    { "ro_cache_hits",   [](const Metrics& m) {
+        // счётчики читаются не атомарно вместе — не уходим в минус
+        const uint64_t gets = m.get_ns.calls();
+        const uint64_t found = gets - std::min(gets, m.get_misses.value());
+        return found - std::min(found, m.ro_cache_misses.value());
+    } },
+    { "ro_cache_misses", [](const Metrics& m) { return m.ro_cache_misses.value(); } },
+    { "compactions",     [](const Metrics& m) { return m.compactions.value(); } },
+};
+
+// sampled: пишется через ScopedTimer с выборкой 1/kSampleEvery
+constexpr HistogramDef kHistograms[] = {
+    { "append",              &Metrics::append_ns,              true  },
+    { "fsync",               &Metrics::fsync_ns,               false },
+    { "read_value",          &Metrics::read_value_ns,          true  },
+    { "get",                 &Metrics::get_ns,                 true  },
+    { "lock_wait_shared",    &Metrics::lock_wait_shared_ns,    true  },
+    { "lock_wait_exclusive", &Metrics::lock_wait_exclusive_ns, true  },
+    { "compact_copy",        &Metrics::compact_copy_ns,        false },
+    { "compact_cleanup",     &Metrics::compact_cleanup_ns,     false },
+    { "bootstrap",           &Metrics::bootstrap_ns,           false },
+    { "checkpoint",          &Metrics::checkpoint_ns,          false },
+};
+
+} // namespace
+
+Metrics g_metrics;
+
+namespace {
+
+// Слоты, освобождённые завершившимися потоками. Передача через мьютекс
+// упорядочивает последнюю запись старого владельца и первую — нового.
+struct StripePool {
+    std::mutex mu;
+    std::vector<size_t> free;
+    size_t next = 0;
+};
+
+StripePool& stripe_pool() {
+    static StripePool pool;
+    return pool;
+}
+
+} // namespace
+
+size_t Counter::next_stripe_() {
+    auto& pool = stripe_pool();
+    size_t idx = kStripes - 1;
+    {
+        std::scoped_lock g(pool.mu);
+        if (!pool.free.empty()) {
+            idx = pool.free.back();
+            pool.free.pop_back();
+        } else if (pool.next < kStripes - 1) {
+            idx = pool.next++;
+        }
+    }
+    if (idx < kStripes - 1) {
+        thread_local StripeOwner owner{ idx };
+    }
+    return idx;
+}
+
+Counter::StripeOwner::~StripeOwner() {
+    // метрики из деструкторов других thread_local этого потока пойдут в общий слот
+    stripe_idx_ = kStripes - 1;
+    auto& pool = stripe_pool();
+    std::scoped_lock g(pool.mu);
+    pool.free.push_back(idx);
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (auto& s : slots_) total += s.v.load(std::memory_order_relaxed);
+    return total;
+}
+
+size_t Histogram::bucket_of(uint64_t ns) {
+    if (ns < 16) return static_cast<size_t>(ns);
+    const int e = 63 - std::countl_zero(ns);          // >= 4
+    const uint64_t sub = (ns >> (e - 2)) & 3;
+    return 16 + static_cast<size_t>(e - 4) * 4 + static_cast<size_t>(sub);
+}
+
+uint64_t Histogram::bucket_upper(size_t idx) {
+    if (idx < 16) return idx;
+    const int e = static_cast<int>((idx - 16) / 4) + 4;
+    const uint64_t sub = (idx - 16) % 4;
+    const uint64_t lower = (4 + sub) << (e - 2);
+    return lower + ((1ull << (e - 2)) - 1);
+}
+
+void Histogram::record(uint64_t ns, uint64_t weight) {
+    buckets_[bucket_of(ns)].fetch_add(weight, std::memory_order_relaxed);
+    sum_.fetch_add(ns * weight, std::memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+    HistogramSnapshot s;
+    uint64_t counts[kBuckets];
+    for (size_t i = 0; i < kBuckets; ++i) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        s.count += counts[i];
+    }
+    s.sum_ns = sum_.load(std::memory_order_relaxed);
+    if (s.count == 0) return s;
+
+    auto quantile = [&](double q) {
+        const auto target = static_cast<uint64_t>(q * static_cast<double>(s.count - 1)) + 1;
+        uint64_t acc = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            acc += counts[i];
+            if (acc >= target) return bucket_upper(i);
+        }
+        return bucket_upper(kBuckets - 1);
+    };
+    s.p50_ns  = quantile(0.50);
+    s.p90_ns  = quantile(0.90);
+    s.p99_ns  = quantile(0.99);
+    s.p999_ns = quantile(0.999);
+    return s;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> Histogram::cumulative() const {
+    std::vector<std::pair<uint64_t, uint64_t>> out;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        const uint64_t c = buckets_[i].load(std::memory_order_relaxed);
+        if (!c) continue;
+        acc += c;
+        out.emplace_back(bucket_upper(i), acc);
+    }
+    return out;
+}
+
+MetricsSnapshot Metrics::snapshot() const {
+    MetricsSnapshot s;
+    for (auto& c : kCounters)   s.counters.emplace_back(c.name, c.value(*this));
+    for (auto& h : kHistograms) s.histograms.emplace_back(h.name, (this->*h.field).snapshot());
+    return s;
+}
+
+void Metrics::write_prometheus(std::ostream& out) const {
+    for (auto& c : kCounters) {
+        out << "# TYPE minidb_" << c.name << "_total counter\n"
+            << "minidb_" << c.name << "_total " << c.value(*this) << '\n';
+    }
+    const auto old_flags = out.flags();
+    const auto old_prec  = out.precision();
+    out << std::setprecision(9);
+    for (auto& h : kHistograms) {
+        const Histogram& hist = this->*h.field;
+        const std::string name = std::string("minidb_") + h.name + "_seconds";
+        if (h.sampled) {
+            out << "# HELP " << name << " sampled 1/" << kSampleEvery
+                << ", bucket counts, _count and _sum scaled to all calls\n";
+        }
+        out << "# TYPE " << name << " histogram\n";
+        uint64_t total = 0;
+        for (auto& [upper, acc] : hist.cumulative()) {
+            out << name << "_bucket{le=\"" << static_cast<double>(upper) / 1e9 << "\"} " << acc << '\n';
+            total = acc;
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << total << '\n'
+            << name << "_sum " << static_cast<double>(hist.sum_ns()) / 1e9 << '\n'
+            << name << "_count " << total << '\n';
+    }
+    out.flags(old_flags);
+    out.precision(old_prec);
+}
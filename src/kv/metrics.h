@@ -0,0 +1,187 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Метрики процесса: счётчики и гистограммы латентности для горячих путей.
+// Всё lock-free и relaxed; выключается через Metrics::set_enabled(false).
+// MINI_DB_METRICS=0 (cmake -DMINI_DB_METRICS=OFF) вырезает инструментирование
+// при компиляции: metrics_add/metrics_record/ScopedTimer становятся пустыми.
+#ifndef MINI_DB_METRICS
+#define MINI_DB_METRICS 1
+#endif
+
+// Счётчик со слотом на поток: одновременно живущие kStripes-1 потоков владеют
+// своим слотом и пишут без lock-префикса, остальные делят последний слот через
+// fetch_add. Слот завершившегося потока (с накопленным значением) переходит
+// следующему новому потоку, так что короткоживущие потоки лимит не исчерпывают.
+class Counter {
+public:
+    // возвращает новое значение слота этого потока
+    uint64_t add(uint64_t n = 1) {
+        const size_t i = stripe_();
+        if (i < kStripes - 1) {
+            auto& v = slots_[i].v;
+            const uint64_t nv = v.load(std::memory_order_relaxed) + n;
+            v.store(nv, std::memory_order_relaxed);
+            return nv;
+        }
+        return slots_[kStripes - 1].v.fetch_add(n, std::memory_order_relaxed) + n;
+    }
+    uint64_t value() const;
+
+private:
+    static constexpr size_t kStripes = 64;
+    static size_t stripe_() {
+        if (stripe_idx_ == SIZE_MAX) [[unlikely]] stripe_idx_ = next_stripe_();
+        return stripe_idx_;
+    }
+    // без динамической инициализации thread_local — обращение без guard
+    static inline thread_local size_t stripe_idx_ = SIZE_MAX;
+    static size_t next_stripe_();
+    // thread_local в next_stripe_(): при завершении потока возвращает слот
+    struct StripeOwner { size_t idx; ~StripeOwner(); };
+    struct alignas(64) Slot { std::atomic<uint64_t> v{0}; };
+    Slot slots_[kStripes];
+};
+
+struct HistogramSnapshot {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t p50_ns = 0, p90_ns = 0, p99_ns = 0, p999_ns = 0;
+};
+
+// Log-linear гистограмма в наносекундах: значения < 16 — точно, дальше по
+// 4 корзины на каждую степень двойки (погрешность ≤ 25%).
+class Histogram {
+public:
+    static constexpr size_t kBuckets = 16 + 60 * 4;
+
+    // число вызовов ScopedTimer по этой гистограмме (не только замеренных);
+    // значение слота потока служит тактом выборки
+    uint64_t tick() { return calls_.add(); }
+    uint64_t calls() const { return calls_.value(); }
+
+    // weight — сколько вызовов представляет замер (kSampleEvery для
+    // сэмплированного), так что count/sum остаются оценкой всех вызовов
+    void record(uint64_t ns, uint64_t weight = 1);
+    HistogramSnapshot snapshot() const;
+    uint64_t sum_ns() const { return sum_.load(std::memory_order_relaxed); }
+    // (верхняя граница корзины, накопленное число) для непустых корзин
+    std::vector<std::pair<uint64_t, uint64_t>> cumulative() const;
+
+    static size_t bucket_of(uint64_t ns);
+    static uint64_t bucket_upper(size_t idx);
+
+private:
+    Counter calls_;
+    std::atomic<uint64_t> buckets_[kBuckets]{};
+    std::atomic<uint64_t> sum_{0};
+};
+
+struct MetricsSnapshot {
+    std::vector<std::pair<std::string, uint64_t>> counters;
+    std::vector<std::pair<std::string, HistogramSnapshot>> histograms;
+};
+
+class Metrics {
+public:
+    // латентность горячих путей пишем для каждого kSampleEvery-го вызова
+    static constexpr uint32_t kSampleEvery = 256;
+
+    // appends, fsyncs и gets — calls() соответствующих гистограмм; попадания
+    // в кэш read-only сегментов тоже не считаем на горячем пути: каждый
+    // найденный GET берёт сегмент ровно раз, hits = gets - misses - ro misses
+    Counter bytes_appended;
+    Counter get_misses;
+    Counter ro_cache_misses;
+    Counter compactions;
+
+    Histogram append_ns;
+    Histogram fsync_ns;
+    Histogram read_value_ns;
+    Histogram get_ns;
+    Histogram lock_wait_shared_ns;
+    Histogram lock_wait_exclusive_ns;
+    Histogram compact_copy_ns;
+    Histogram compact_cleanup_ns;
+    Histogram bootstrap_ns;
+    Histogram checkpoint_ns;
+
+#if MINI_DB_METRICS
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+#else
+    constexpr bool enabled() const { return false; }
+#endif
+    void set_enabled(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+
+    MetricsSnapshot snapshot() const;
+    // счётчики и гистограммы в text exposition format Prometheus
+    void write_prometheus(std::ostream& out) const;
+
+private:
+    std::atomic<bool> enabled_{true};
+};
+
+extern Metrics g_metrics;
+inline Metrics& metrics() { return g_metrics; }
+
+inline uint64_t metrics_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline void metrics_add(Counter& c, uint64_t n = 1) {
+    if (metrics().enabled()) c.add(n);
+}
+
+inline void metrics_record(Histogram& h, uint64_t ns) {
+    if (metrics().enabled()) h.record(ns);
+}
+
+// Замер времени до конца области видимости; заодно считает вызов в
+// Histogram::calls(). sampled=true — замер только каждого kSampleEvery-го
+// вызова в потоке (для путей, где сам now() заметен). Такт — слот calls()
+// этой гистограммы, так что таймеры, идущие в фиксированном порядке
+// (ожидание mu_ и append в set()), не попадают в выборку через раз.
+#if MINI_DB_METRICS
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& h, bool sampled = true) : h_(h) {
+        if (!metrics().enabled()) return;
+        const uint64_t n = h.tick();
+        if (sampled) {
+            if (n % Metrics::kSampleEvery != 0) return;
+            weight_ = Metrics::kSampleEvery;
+        }
+        start_ = metrics_now_ns();
+    }
+    // Фаза операции parent: замеряется ровно тогда, когда замеряется parent,
+    // такт не крутит — на горячем пути одно решение о выборке на операцию.
+    ScopedTimer(Histogram& h, const ScopedTimer& parent) : h_(h) {
+        if (!parent.start_) return;
+        weight_ = parent.weight_;
+        start_ = metrics_now_ns();
+    }
+    ~ScopedTimer() { if (start_) h_.record(metrics_now_ns() - start_, weight_); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& h_;
+    uint64_t start_ = 0;
+    uint32_t weight_ = 1;
+};
+#else
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram&, bool = true) {}
+    ScopedTimer(Histogram&, const ScopedTimer&) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+#endif
@@ -1,57 +1,195 @@
 #include "win_file.h"
+#include "metrics.h"
 #include <stdexcept>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
 
 #ifdef _WIN32
+#include <malloc.h>
 static std::wstring to_w(const std::filesystem::path& p) {
     return p.wstring();
 }
 #endif
 
+static constexpr uint64_t align_down(uint64_t v) { return v & ~uint64_t(WinFile::kDirectAlign - 1); }
+static constexpr uint64_t align_up(uint64_t v)   { return align_down(v + WinFile::kDirectAlign - 1); }
+
+AlignedBuffer::~AlignedBuffer() {
+#ifdef _WIN32
+    ::_aligned_free(data_);
+#else
+    std::free(data_);
+#endif
+}
+
+void AlignedBuffer::reserve(size_t capacity, size_t keep) {
+    if (capacity <= cap_) return;
+    const size_t n = static_cast<size_t>(align_up(capacity));
+#ifdef _WIN32
+    auto* p = static_cast<unsigned char*>(::_aligned_malloc(n, WinFile::kDirectAlign));
+#else
+    auto* p = static_cast<unsigned char*>(std::aligned_alloc(WinFile::kDirectAlign, n));
+#endif
+    if (!p) throw std::bad_alloc();
+    if (keep) std::memcpy(p, data_, keep);
+#ifdef _WIN32
+    ::_aligned_free(data_);
+#else
+    std::free(data_);
+#endif
+    data_ = p;
+    cap_ = n;
+}
+
 WinFile::~WinFile() { close(); }
 
-void WinFile::open_append(const std::filesystem::path& p) {
+void WinFile::open_append(const std::filesystem::path& p, bool direct) {
     close();
     path_ = p;
 #ifdef _WIN32
-    handle_ = ::CreateFileW(
-        to_w(p).c_str(),
-        GENERIC_READ | FILE_APPEND_DATA | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        OPEN_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr
-    );
+    auto create = [&](DWORD flags) {
+        return ::CreateFileW(
+            to_w(p).c_str(),
+            GENERIC_READ | FILE_APPEND_DATA | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr,
+            OPEN_ALWAYS,
+            flags,
+            nullptr
+        );
+    };
+    if (direct) {
+        handle_ = create(FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH);
+        if (handle_ != INVALID_HANDLE_VALUE) direct_ = true;
+        else if (::GetLastError() != ERROR_INVALID_PARAMETER)
+            throw std::runtime_error("CreateFileW (append, direct) failed");
+    }
+    if (handle_ == INVALID_HANDLE_VALUE) handle_ = create(FILE_ATTRIBUTE_NORMAL);
     if (handle_ == INVALID_HANDLE_VALUE)
         throw std::runtime_error("CreateFileW (append) failed");
 #else
-    fd_ = ::open(p.c_str(), O_CREAT | O_RDWR, 0644);
+#ifdef O_DIRECT
+    if (direct) {
+        fd_ = ::open(p.c_str(), O_CREAT | O_RDWR | O_DIRECT, 0644);
+        if (fd_ >= 0) direct_ = true;
+        else if (errno != EINVAL) throw std::runtime_error("open (append, direct) failed");
+    }
+#endif
+    if (fd_ < 0) fd_ = ::open(p.c_str(), O_CREAT | O_RDWR, 0644);
     if (fd_ < 0) throw std::runtime_error("open (append) failed");
 #endif
+    writable_ = true;
+    if (direct_) {
+        tail_ = physical_size_();
+        load_tail_block_();
+    }
 }
 
-void WinFile::open_readonly(const std::filesystem::path& p) {
+void WinFile::open_readonly(const std::filesystem::path& p, bool direct) {
     close();
     path_ = p;
 #ifdef _WIN32
-    handle_ = ::CreateFileW(
-        to_w(p).c_str(),
-        GENERIC_READ,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr
-    );
+    auto create = [&](DWORD flags) {
+        return ::CreateFileW(
+            to_w(p).c_str(),
+            GENERIC_READ,
+            // DELETE: читатель (реплика) не должен мешать compaction удалять сегмент
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            flags,
+            nullptr
+        );
+    };
+    if (direct) {
+        handle_ = create(FILE_FLAG_NO_BUFFERING);
+        if (handle_ != INVALID_HANDLE_VALUE) direct_ = true;
+        else if (::GetLastError() != ERROR_INVALID_PARAMETER)
+            throw std::runtime_error("CreateFileW (ro, direct) failed");
+    }
+    if (handle_ == INVALID_HANDLE_VALUE) handle_ = create(FILE_ATTRIBUTE_NORMAL);
     if (handle_ == INVALID_HANDLE_VALUE)
         throw std::runtime_error("CreateFileW (ro) failed");
 #else
-    fd_ = ::open(p.c_str(), O_RDONLY);
+#ifdef O_DIRECT
+    if (direct) {
+        fd_ = ::open(p.c_str(), O_RDONLY | O_DIRECT);
+        if (fd_ >= 0) direct_ = true;
+        else if (errno != EINVAL) throw std::runtime_error("open (ro, direct) failed");
+    }
+#endif
+    if (fd_ < 0) fd_ = ::open(p.c_str(), O_RDONLY);
     if (fd_ < 0) throw std::runtime_error("open (ro) failed");
 #endif
 }
 
+void WinFile::load_tail_block_() {
+    wbuf_.reserve(kDirectAlign);
+    const uint64_t blk = align_down(tail_);
+    const size_t head = static_cast<size_t>(tail_ - blk);
+    if (head && raw_read_(blk, wbuf_.data(), kDirectAlign) < head)
+        throw std::runtime_error("tail block read failed");
+}
+
+size_t WinFile::raw_read_(uint64_t offset, void* out, size_t size) const {
+    size_t done = 0;
+    auto* dst = static_cast<unsigned char*>(out);
+    while (done < size) {
+        const uint64_t at = offset + done;
+#ifdef _WIN32
+        OVERLAPPED ov{};
+        ov.Offset     = static_cast<DWORD>(at & 0xFFFFFFFFull);
+        ov.OffsetHigh = static_cast<DWORD>((at >> 32) & 0xFFFFFFFFull);
+        DWORD got = 0;
+        if (!::ReadFile(handle_, dst + done, static_cast<DWORD>(size - done), &got, &ov)) {
+            if (::GetLastError() == ERROR_HANDLE_EOF) break;
+            throw std::runtime_error("ReadFile failed");
+        }
+#else
+        ssize_t got = ::pread(fd_, dst + done, size - done, static_cast<off_t>(at));
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("pread failed");
+        }
+#endif
+        if (got == 0) break;
+        done += static_cast<size_t>(got);
+        // unbuffered-чтение у EOF возвращает неполный блок — дальше читать нечего
+        if (direct_ && (done % kDirectAlign) != 0) break;
+    }
+    return done;
+}
+
+void WinFile::raw_write_(uint64_t offset, const void* data, size_t size) {
+#ifdef _WIN32
+    OVERLAPPED ov{};
+    ov.Offset     = static_cast<DWORD>(offset & 0xFFFFFFFFull);
+    ov.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFFull);
+    DWORD written = 0;
+    if (!::WriteFile(handle_, data, static_cast<DWORD>(size), &written, &ov) || written != size)
+        throw std::runtime_error("WriteFile failed");
+#else
+    size_t done = 0;
+    auto* src = static_cast<const unsigned char*>(data);
+    while (done < size) {
+        ssize_t w = ::pwrite(fd_, src + done, size - done, static_cast<off_t>(offset + done));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("pwrite failed");
+        }
+        done += static_cast<size_t>(w);
+    }
+#endif
+}
+
 uint64_t WinFile::size() const {
+    if (direct_ && writable_) return tail_;
+    return physical_size_();
+}
+
+uint64_t WinFile::physical_size_() const {
 #ifdef _WIN32
     LARGE_INTEGER sz{};
     if (!::GetFileSizeEx(handle_, &sz)) throw std::runtime_error("GetFileSizeEx failed");
@@ -64,6 +202,23 @@ uint64_t WinFile::size() const {
 }
 
 uint64_t WinFile::append(const void* data, uint32_t size) {
+    if (direct_) {
+        // переписываем неполный хвостовой блок вместе с новыми данными,
+        // остаток последнего блока заполняем нулями (scan на них остановится)
+        const uint64_t off = tail_;
+        const uint64_t blk = align_down(off);
+        const size_t head = static_cast<size_t>(off - blk);
+        const size_t span = static_cast<size_t>(align_up(head + size));
+        wbuf_.reserve(span, head);
+        std::memcpy(wbuf_.data() + head, data, size);
+        std::memset(wbuf_.data() + head + size, 0, span - head - size);
+        raw_write_(blk, wbuf_.data(), span);
+
+        tail_ = off + size;
+        const size_t last = static_cast<size_t>(align_down(tail_) - blk);
+        if (last) std::memmove(wbuf_.data(), wbuf_.data() + last, static_cast<size_t>(tail_ - align_down(tail_)));
+        return off;
+    }
     uint64_t off = this->size();
 #ifdef _WIN32
     LARGE_INTEGER li; li.QuadPart = 0;
@@ -83,6 +238,18 @@ uint64_t WinFile::append(const void* data, uint32_t size) {
 }
 
 void WinFile::read_at(uint64_t offset, void* out, uint32_t size) const {
+    if (direct_) {
+        // смещение/длина/буфер должны быть выровнены — читаем через bounce-буфер
+        thread_local AlignedBuffer bounce;
+        const uint64_t start = align_down(offset);
+        const size_t lead = static_cast<size_t>(offset - start);
+        const size_t span = static_cast<size_t>(align_up(lead + size));
+        bounce.reserve(span);
+        if (raw_read_(start, bounce.data(), span) < lead + size)
+            throw std::runtime_error("direct read failed");
+        std::memcpy(out, bounce.data() + lead, size);
+        return;
+    }
 #ifdef _WIN32
     OVERLAPPED ov{};
     ov.Offset     = static_cast<DWORD>(offset & 0xFFFFFFFFull);
@@ -98,6 +265,7 @@ void WinFile::read_at(uint64_t offset, void* out, uint32_t size) const {
 }
 
 void WinFile::flush() {
+    ScopedTimer t(metrics().fsync_ns, false);
 #ifdef _WIN32
     if (!::FlushFileBuffers(handle_)) throw std::runtime_error("FlushFileBuffers failed");
 #else
@@ -105,7 +273,35 @@ void WinFile::flush() {
 #endif
 }
 
+void WinFile::truncate(uint64_t size) {
+    set_end_of_file_(size);
+    if (direct_ && writable_) {
+        tail_ = size;
+        load_tail_block_();
+    }
+}
+
+void WinFile::set_end_of_file_(uint64_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER li; li.QuadPart = static_cast<LONGLONG>(size);
+    if (!::SetFilePointerEx(handle_, li, nullptr, FILE_BEGIN) || !::SetEndOfFile(handle_))
+        throw std::runtime_error("SetEndOfFile failed");
+#else
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) throw std::runtime_error("ftruncate failed");
+#endif
+}
+
 void WinFile::close() {
+    // срезаем нулевой padding последнего блока, чтобы закрытый сегмент
+    // имел точный размер
+    if (direct_ && writable_ && is_open()) {
+        try {
+            if (physical_size_() != tail_) set_end_of_file_(tail_);
+        } catch (...) {}
+    }
+    direct_ = false;
+    writable_ = false;
+    tail_ = 0;
 #ifdef _WIN32
     if (handle_ != INVALID_HANDLE_VALUE) {
         ::CloseHandle(handle_);
@@ -117,4 +313,24 @@ void WinFile::close() {
         fd_ = -1;
     }
 #endif
-}
\ No newline at end of file
+}
+void WinFile::sync_path(const std::filesystem::path& p) {
+#ifdef _WIN32
+    // каталог на NTFS синхронизирует журнал метаданных, FlushFileBuffers
+    // для него не нужен (и требует особых прав)
+    if (std::filesystem::is_directory(p)) return;
+    HANDLE h = ::CreateFileW(to_w(p).c_str(), GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("CreateFileW failed");
+    const BOOL ok = ::FlushFileBuffers(h);
+    ::CloseHandle(h);
+    if (!ok) throw std::runtime_error("FlushFileBuffers failed");
+#else
+    const int fd = ::open(p.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("open failed");
+    const int rc = ::fsync(fd);
+    ::close(fd);
+    if (rc != 0) throw std::runtime_error("fsync failed");
+#endif
+}
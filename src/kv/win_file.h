@@ -1,6 +1,7 @@
 #pragma once
 #include <filesystem>
 #include <cstdint>
+#include <cstddef>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -10,18 +11,44 @@
 #include <sys/stat.h>
 #endif
 
+// Буфер с выравниванием под unbuffered I/O (O_DIRECT / FILE_FLAG_NO_BUFFERING).
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    ~AlignedBuffer();
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    // capacity округляется вверх до alignment; первые keep байт сохраняются
+    void reserve(size_t capacity, size_t keep = 0);
+    unsigned char* data() { return data_; }
+    size_t capacity() const { return cap_; }
+
+private:
+    unsigned char* data_ = nullptr;
+    size_t cap_ = 0;
+};
+
 class WinFile {
 public:
+    // Гранулярность unbuffered I/O (верхняя граница размера сектора).
+    static constexpr uint32_t kDirectAlign = 4096;
+
     WinFile() = default;
     ~WinFile();
 
-    void open_append(const std::filesystem::path& p);
-    void open_readonly(const std::filesystem::path& p);
+    // direct=true: мимо page cache. Если ФС не поддерживает (EINVAL /
+    // ERROR_INVALID_PARAMETER при открытии) — молча остаёмся в buffered.
+    void open_append(const std::filesystem::path& p, bool direct = false);
+    void open_readonly(const std::filesystem::path& p, bool direct = false);
 
     uint64_t append(const void* data, uint32_t size);
     void read_at(uint64_t offset, void* out, uint32_t size) const;
     void flush();
     uint64_t size() const;
+    // Обрезает файл до size; в direct-режиме переносит логический хвост.
+    void truncate(uint64_t size);
+    bool is_direct() const { return direct_; }
     bool is_open() const {
 #ifdef _WIN32
         return handle_ != INVALID_HANDLE_VALUE;
@@ -31,6 +58,10 @@ public:
     }
     void close();
 
+    // fsync файла или каталога по пути (для файлов, которые мы не держим
+    // открытыми: жёсткие ссылки, копии, MANIFEST)
+    static void sync_path(const std::filesystem::path& p);
+
 private:
 #ifdef _WIN32
     HANDLE handle_ = INVALID_HANDLE_VALUE;
@@ -38,4 +69,18 @@ private:
     int fd_ = -1;
 #endif
     std::filesystem::path path_;
-};
\ No newline at end of file
+
+    // direct-режим: файл пишется целыми блоками, хвост последнего блока
+    // дополнен нулями; tail_ — логический конец данных, wbuf_ начинается
+    // с последнего неполного блока (tail_ % kDirectAlign валидных байт).
+    bool direct_ = false;
+    bool writable_ = false;
+    uint64_t tail_ = 0;
+    AlignedBuffer wbuf_;
+
+    uint64_t physical_size_() const;
+    void set_end_of_file_(uint64_t size);
+    void load_tail_block_();
+    size_t raw_read_(uint64_t offset, void* out, size_t size) const;
+    void raw_write_(uint64_t offset, const void* data, size_t size);
+};
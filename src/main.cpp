@@ -1,16 +1,48 @@
 #include "kv/kvstore.h"
 #include <iostream>
 #include <sstream>
+#include <string_view>
+#include <iomanip>
 
-int main() {
+static void print_stats(const Stats& st) {
+    std::cout << "seq " << st.seq << "\n"
+              << "keys " << st.keys << "\n"
+              << "segments " << st.segments << "\n"
+              << "total_bytes " << st.total_bytes << "\n"
+              << "live_bytes " << st.live_bytes << "\n"
+              << "dead_bytes " << st.dead_bytes << "\n"
+              << "replica_lag " << st.replica_lag << "\n"
+              << std::fixed << std::setprecision(3)
+              << "last_compact_ms " << st.last_compact_ns / 1e6 << "\n"
+              << "last_bootstrap_ms " << st.last_bootstrap_ns / 1e6 << "\n";
+    for (auto& [name, v] : st.metrics.counters)
+        std::cout << name << ' ' << v << "\n";
+    std::cout << std::setprecision(1);
+    for (auto& [name, h] : st.metrics.histograms) {
+        if (!h.count) continue;
+        std::cout << name << "_us n=" << h.count
+                  << " p50=" << h.p50_ns / 1e3 << " p90=" << h.p90_ns / 1e3
+                  << " p99=" << h.p99_ns / 1e3 << " p999=" << h.p999_ns / 1e3 << "\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+int main(int argc, char** argv) {
     try {
         Config cfg;
         cfg.data_dir = L"./data";
         cfg.segment_max_bytes = 8ull * 1024 * 1024;
         cfg.fsync_each_write = true;
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg == "--direct-io") cfg.direct_io = true;
+            else if (arg == "--data" && i + 1 < argc) cfg.data_dir = argv[++i];
+            else if (arg == "--replica-of" && i + 1 < argc) cfg.replica_of = argv[++i];
+        }
 
         KVStore db(cfg);
-        std::cout << "MiniDB (SET key value | GET key | DEL key | COMPACT | EXIT)\n";
+        std::cout << "MiniDB (SET key value | GET key | DEL key | COMPACT | CHECKPOINT dir | STATS [file] | "
+                     "SEQ | WAIT seq [ms] | REPLICA | EXIT)\n";
 
         std::string line;
         while (true) {
@@ -18,7 +50,9 @@ int main() {
             if (!std::getline(std::cin, line)) break;
             std::istringstream iss(line);
             std::string cmd; iss >> cmd;
-            if (cmd=="SET") {
+            if ((cmd=="SET" || cmd=="DEL" || cmd=="COMPACT") && db.is_replica()) {
+                std::cout << "ERROR: read-only replica\n";
+            } else if (cmd=="SET") {
                 std::string key; iss >> key;
                 std::string value; std::getline(iss, value);
                 if (!value.empty() && value[0]==' ') value.erase(0,1);
@@ -40,6 +74,37 @@ int main() {
                 } else {
                     std::cout << "COMPACTED\n";
                 }
+            } else if (cmd=="CHECKPOINT") {
+                std::string dir; iss >> dir;
+                if (dir.empty()){ std::cout<<"usage: CHECKPOINT <dir>\n"; continue; }
+                if (auto ec = db.checkpoint(dir); ec) {
+                    std::cout << "ERROR: " << ec.message() << "\n";
+                } else {
+                    std::cout << "CHECKPOINTED\n";
+                }
+            } else if (cmd=="SEQ") {
+                std::cout << db.last_seq() << "\n";
+            } else if (cmd=="WAIT") {
+                uint64_t seq = 0; uint64_t ms = 1000;
+                if (!(iss >> seq)){ std::cout<<"usage: WAIT <seq> [ms]\n"; continue; }
+                iss >> ms;
+                std::cout << (db.wait_for_seq(seq, std::chrono::milliseconds(ms)) ? "OK" : "TIMEOUT") << "\n";
+            } else if (cmd=="REPLICA") {
+                if (!db.is_replica()) { std::cout << "not a replica\n"; continue; }
+                auto rs = db.replica_status();
+                std::cout << "applied_seq " << rs.applied_seq << "\n"
+                          << "primary_seq " << rs.primary_seq << "\n"
+                          << "lag " << rs.lag << "\n"
+                          << "resyncs " << rs.resyncs << "\n";
+            } else if (cmd=="STATS") {
+                std::string file; iss >> file;
+                if (file.empty()) {
+                    print_stats(db.stats());
+                } else if (auto ec = db.dump_metrics(file); ec) {
+                    std::cout << "ERROR: " << ec.message() << "\n";
+                } else {
+                    std::cout << "OK\n";
+                }
             } else if (cmd=="EXIT") {
                 break;
             } else {